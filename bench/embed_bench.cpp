@@ -0,0 +1,93 @@
+#include "../embed.h"
+#include <iostream>
+#include <string>
+#include <chrono>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <spawn.h>
+#include <sys/wait.h>
+
+using namespace std;
+
+// What a caller saves by linking the executor instead of starting a shell for every line: runs the same
+// line through runCapturedLine and through a fresh ./eshell whose output is read back over a pipe.
+// Usage: embed_bench [calls]
+
+extern char** environ;
+
+const char* LINE = "echo alpha beta | tr a-z A-Z , printf x | wc -c";
+
+// The line on an eshell's stdin, its stdout collected the way a caller shelling out would
+string runShelledOut(const string& line){
+    int in[2], out[2];
+    if(pipe(in) < 0 || pipe(out) < 0){
+        perror("pipe");
+        exit(1);
+    }
+
+    posix_spawn_file_actions_t actions;
+    posix_spawn_file_actions_init(&actions);
+    posix_spawn_file_actions_adddup2(&actions, in[0], STDIN_FILENO);
+    posix_spawn_file_actions_adddup2(&actions, out[1], STDOUT_FILENO);
+    posix_spawn_file_actions_addclose(&actions, in[1]);
+    posix_spawn_file_actions_addclose(&actions, out[0]);
+
+    char* args[] = { (char*)"./eshell", NULL };
+    pid_t pid;
+    if(posix_spawn(&pid, args[0], &actions, NULL, args, environ) != 0){
+        perror("posix_spawn");
+        exit(1);
+    }
+    posix_spawn_file_actions_destroy(&actions);
+    close(in[0]);
+    close(out[1]);
+
+    auto script = line + "\nquit\n";
+    if(write(in[1], script.data(), script.size()) != (ssize_t)script.size()){
+        perror("write");
+    }
+    close(in[1]);
+
+    string output;
+    char buffer[4096];
+    ssize_t count;
+    while((count = read(out[0], buffer, sizeof(buffer))) > 0){
+        output.append(buffer, count);
+    }
+    close(out[0]);
+    waitpid(pid, NULL, 0);
+    return output;
+}
+
+int main(int argc, char* argv[]){
+    auto calls = argc > 1 ? atoi(argv[1]) : 500;
+
+    auto bad = runCapturedLine("echo a ; (echo b) | cat", "");
+    cerr << "parse error comes back as status " << bad.status << ": " << bad.error << endl;
+    auto piped = runCapturedLine("tr a-z A-Z", "from memory\n");
+    cerr << "stdin from memory: " << piped.out;
+
+    size_t bytes = 0;
+    auto started = chrono::steady_clock::now();
+    for(int i = 0; i < calls; i++){
+        auto result = runCapturedLine(LINE, "");
+        if(result.status != 0 || !result.error.empty()){
+            cerr << "line failed: " << result.status << " " << result.error << endl;
+            return 1;
+        }
+        bytes += result.out.size();
+    }
+    auto embedded = chrono::duration<double, micro>(chrono::steady_clock::now() - started).count() / calls;
+
+    started = chrono::steady_clock::now();
+    for(int i = 0; i < calls; i++){
+        bytes += runShelledOut(LINE).size();
+    }
+    auto shelled = chrono::duration<double, micro>(chrono::steady_clock::now() - started).count() / calls;
+
+    fprintf(stderr, "%d calls, %zu bytes captured\n", calls, bytes);
+    fprintf(stderr, "  runCapturedLine   %8.1f us per call\n", embedded);
+    fprintf(stderr, "  eshell per call   %8.1f us per call\n", shelled);
+    return 0;
+}
@@ -0,0 +1,87 @@
+#include "../fanout.h"
+#include <iostream>
+#include <vector>
+#include <chrono>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+using namespace std;
+
+// Times the repeater's blocking write loop against the io_uring writer, broadcasting the same
+// payload to 2, 8 and 64 consumers that just drain their pipe.
+// Usage: fanout_bench [megabytes per consumer]
+
+const size_t CHUNK_SIZE = 256 * 1024;
+
+double runOnce(FanOutBackend backend, int consumers, size_t totalBytes, long long& syscalls, const char*& name){
+    vector<int> writeFds;
+    vector<pid_t> pids;
+
+    for(int i = 0; i < consumers; i++){
+        int fd[2];
+        if(pipe(fd) < 0){
+            perror("pipe");
+            exit(1);
+        }
+
+        auto pid = fork();
+        if(pid == 0){
+            close(fd[1]);
+            for(auto other : writeFds){
+                close(other);
+            }
+            char buffer[65536];
+            while(read(fd[0], buffer, sizeof(buffer)) > 0){
+            }
+            _exit(0);
+        }
+
+        close(fd[0]);
+        writeFds.push_back(fd[1]);
+        pids.push_back(pid);
+    }
+
+    auto writer = createFanOutWriter(backend);
+    name = writer->name();
+    vector<char> chunk(CHUNK_SIZE, 'x');
+    vector<bool> failed(consumers, false);
+
+    auto start = chrono::steady_clock::now();
+    for(size_t sent = 0; sent < totalBytes; sent += CHUNK_SIZE){
+        writer->broadcast(chunk.data(), chunk.size(), writeFds, failed);
+    }
+    for(auto fd : writeFds){
+        close(fd);
+    }
+    for(auto pid : pids){
+        waitpid(pid, NULL, 0);
+    }
+    auto elapsed = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+    syscalls = writer->syscalls();
+    delete writer;
+    return elapsed;
+}
+
+int main(int argc, char* argv[]){
+    size_t megabytes = argc > 1 ? atoi(argv[1]) : 16;
+    size_t totalBytes = megabytes * 1024 * 1024;
+
+    int consumerCounts[] = { 2, 8, 64 };
+    FanOutBackend backends[] = { FanOutBackend::Blocking, FanOutBackend::Uring };
+
+    printf("%zu MiB to each consumer in %zu KiB chunks\n", megabytes, CHUNK_SIZE / 1024);
+    for(auto consumers : consumerCounts){
+        for(auto backend : backends){
+            long long syscalls;
+            const char* name;
+            auto elapsed = runOnce(backend, consumers, totalBytes, syscalls, name);
+            printf("%3d consumers  %-9s %8.1f ms  %10lld syscalls  %8.1f MiB/s total\n", consumers, name,
+                   elapsed * 1000, syscalls, megabytes * consumers / elapsed);
+        }
+    }
+
+    return 0;
+}
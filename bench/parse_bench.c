@@ -0,0 +1,141 @@
+#define _POSIX_C_SOURCE 199309L
+#include "../parser.h"
+#include <time.h>
+
+/*
+ * Compares parse_line with the pre-scan disabled (the old char by char state machine)
+ * against every pre-scan kernel on the same generated corpus of long lines.
+ * Usage: parse_bench [lines] [iterations]
+ */
+
+#define ARG_LENGTH 200
+
+static char *make_arg(unsigned seed, int quoted) {
+    char *arg = (char *)malloc(ARG_LENGTH + 3);
+    int n = 0;
+    if ( quoted )
+        arg[n++] = '"';
+    for ( int i=0; i<ARG_LENGTH; i++ ) {
+        seed = seed*1103515245u + 12345u;
+        char c = 'a' + (seed>>16)%26;
+        arg[n++] = quoted && (seed>>8)%9 == 0 ? ' ' : c;
+    }
+    if ( quoted )
+        arg[n++] = '"';
+    arg[n] = '\0';
+    return arg;
+}
+
+static char *make_line(unsigned seed) {
+    static const char *separators[] = { " | ", " ; ", " , " };
+    const char *separator = separators[seed%3];
+    size_t capacity = MAX_INPUTS*MAX_ARGS*(ARG_LENGTH+8);
+    char *line = (char *)malloc(capacity);
+    line[0] = '\0';
+    for ( int i=0; i<MAX_INPUTS; i++ ) {
+        if ( i )
+            strcat(line, separator);
+        strcat(line, "command");
+        for ( int a=1; a<MAX_ARGS-1; a++ ) {
+            char *arg = make_arg(seed*31u + i*97u + a, a%4 == 0);
+            strcat(line, "   ");
+            strcat(line, arg);
+            free(arg);
+        }
+    }
+    return line;
+}
+
+static int same_command(command *a, command *b) {
+    for ( int i=0; i<MAX_ARGS; i++ ) {
+        if ( (a->args[i] == NULL) != (b->args[i] == NULL) )
+            return 0;
+        if ( a->args[i] == NULL )
+            return 1;
+        if ( strcmp(a->args[i], b->args[i]) )
+            return 0;
+    }
+    return 1;
+}
+
+static int same_input(parsed_input *a, parsed_input *b) {
+    if ( a->num_inputs != b->num_inputs || a->separator != b->separator )
+        return 0;
+    for ( int i=0; i<a->num_inputs; i++ ) {
+        single_input *x = &a->inputs[i], *y = &b->inputs[i];
+        if ( x->type != y->type )
+            return 0;
+        if ( x->type == INPUT_TYPE_COMMAND && !same_command(&x->data.cmd, &y->data.cmd) )
+            return 0;
+        if ( x->type == INPUT_TYPE_SUBSHELL && strcmp(x->data.subshell, y->data.subshell) )
+            return 0;
+        if ( x->type == INPUT_TYPE_PIPELINE ) {
+            if ( x->data.pline.num_commands != y->data.pline.num_commands )
+                return 0;
+            for ( int c=0; c<x->data.pline.num_commands; c++ )
+                if ( !same_command(&x->data.pline.commands[c], &y->data.pline.commands[c]) )
+                    return 0;
+        }
+    }
+    return 1;
+}
+
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec/1e9;
+}
+
+int main(int argc, char *argv[]) {
+    int line_count = argc > 1 ? atoi(argv[1]) : 200;
+    int iterations = argc > 2 ? atoi(argv[2]) : 20;
+
+    char **lines = (char **)malloc(line_count*sizeof(char *));
+    size_t bytes = 0;
+    for ( int i=0; i<line_count; i++ ) {
+        lines[i] = make_line(i);
+        bytes += strlen(lines[i]);
+    }
+
+    static const SCAN_MODE modes[] = { SCAN_MODE_OFF, SCAN_MODE_SCALAR, SCAN_MODE_SSE2, SCAN_MODE_AVX2 };
+    static const char *names[] = { "char-by-char", "scalar", "sse2", "avx2" };
+    parsed_input reference, input;
+
+    printf("%d lines, %.1f KiB per pass, %d passes\n", line_count, bytes/1024.0, iterations);
+    for ( int m=0; m<4; m++ ) {
+        parser_set_scan_mode(modes[m]);
+        if ( parser_active_scan_mode() != modes[m] ) {
+            printf("%-14s unavailable on this machine\n", names[m]);
+            continue;
+        }
+
+        for ( int i=0; i<line_count; i++ ) {
+            parser_set_scan_mode(SCAN_MODE_OFF);
+            int ok_reference = parse_line(lines[i], &reference);
+            parser_set_scan_mode(modes[m]);
+            int ok = parse_line(lines[i], &input);
+            if ( ok != ok_reference || !same_input(&reference, &input) ) {
+                printf("%-14s MISMATCH on line %d\n", names[m], i);
+                return 1;
+            }
+            free_parsed_input(&reference);
+            free_parsed_input(&input);
+        }
+
+        double start = now();
+        for ( int it=0; it<iterations; it++ ) {
+            for ( int i=0; i<line_count; i++ ) {
+                parse_line(lines[i], &input);
+                free_parsed_input(&input);
+            }
+        }
+        double elapsed = now() - start;
+        printf("%-14s %8.2f ms  %8.1f MiB/s\n", names[m], elapsed*1000,
+               bytes*(double)iterations/elapsed/(1024.0*1024.0));
+    }
+
+    for ( int i=0; i<line_count; i++ )
+        free(lines[i]);
+    free(lines);
+    return 0;
+}
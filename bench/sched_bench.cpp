@@ -0,0 +1,226 @@
+#include "../executor.h"
+#include "../process.h"
+#include "../simprocess.h"
+#include <iostream>
+#include <string>
+#include <vector>
+#include <random>
+#include <chrono>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+using namespace std;
+
+// Measures what the executor itself costs per line: the same generated pipelines, parallel groups,
+// sequences, repeaters and shards run on the simulated process backend, so nothing is spawned.
+// With --fuzz, lines and scheduling are random and every wiring problem the simulation finds is printed.
+// Usage: sched_bench [lines]                 simulated, 10000 lines by default
+//        sched_bench --posix [lines]         the same lines with real processes, for comparison
+//        sched_bench --fuzz SEED [lines]     exits with 1 if any line had a problem
+// Commands' own output (signal reports and the like) goes to /dev/null, results to stderr.
+
+const char* COMMANDS[] = { "true", "cat", "false" };
+
+struct LineGenerator {
+    mt19937 random;
+
+    explicit LineGenerator(unsigned seed) : random(seed) {}
+
+    int pick(int count){
+        return random() % count;
+    }
+
+    string command(){
+        // Mostly commands that succeed, so sequences get past their first step
+        return COMMANDS[pick(8) < 6 ? pick(2) : 2];
+    }
+
+    string commands(int count, const char* separator){
+        string text = command();
+        for(int i = 1; i < count; i++){
+            text += separator + command();
+        }
+        return text;
+    }
+
+    // Inside a subshell: anything without parentheses
+    string group(){
+        switch(pick(4)){
+        case 0:
+            return commands(2 + pick(3), " , ");
+        case 1:
+            return commands(2 + pick(3), " | ");
+        case 2:
+            return sequence();
+        default:
+            return command();
+        }
+    }
+
+    // One input of a sequence or a parallel group. Subshells can't nest, so only top level groups get them.
+    string member(bool subshells){
+        switch(pick(subshells ? 4 : 3)){
+        case 0:
+            return commands(2, " | ");
+        case 3:
+            return "(" + group() + ")";
+        default:
+            return command();
+        }
+    }
+
+    string sequence(bool subshells = false){
+        static const char* links[] = { " ; ", " && ", " || " };
+        string text = member(subshells);
+        for(int i = 1 + pick(3); i > 0; i--){
+            text += links[pick(3)] + member(subshells);
+        }
+        return text;
+    }
+
+    string shard(){
+        static const char* policies[] = { "rr:", "least:", "hash:", "hash=2:" };
+        string text = string("[") + policies[pick(4)] + (pick(2) ? commands(2, " | ") : command());
+        for(int i = 1 + pick(2); i > 0; i--){
+            text += " , " + (pick(2) ? commands(2, " | ") : command());
+        }
+        return text + "]";
+    }
+
+    string pipeline(){
+        string text = command();
+        for(int i = 1 + pick(3); i > 0; i--){
+            switch(pick(4)){
+            case 0:
+                text += " | (" + group() + ")";
+                break;
+            case 1:
+                text += " | " + shard();
+                break;
+            default:
+                text += " | " + command();
+            }
+        }
+        return text;
+    }
+
+    string parallel(){
+        string text = member(true);
+        for(int i = 1 + pick(3); i > 0; i--){
+            text += " , " + member(true);
+        }
+        return text;
+    }
+
+    string line(){
+        switch(pick(5)){
+        case 0:
+        case 1:
+            return pipeline();
+        case 2:
+            return parallel();
+        case 3:
+            return sequence(true);
+        default:
+            return "(" + group() + ")";
+        }
+    }
+};
+
+parsed_input* parse(string& line){
+    auto input = new parsed_input;
+    char error[PARSE_ERROR_SIZE];
+    if(!parse_line_r(&line[0], input, error, sizeof(error))){
+        fprintf(stderr, "generated a line that doesn't parse: %s\n%s\n", line.c_str(), error);
+        exit(2);
+    }
+    return input;
+}
+
+// Commands print nothing, but the executor reports signals on stdout
+void silenceStdout(){
+    auto null = open("/dev/null", O_RDWR);
+    dup2(null, STDIN_FILENO);
+    dup2(null, STDOUT_FILENO);
+    close(null);
+}
+
+int benchmark(bool posix, int count){
+    LineGenerator generator(1);
+    vector<string> lines;
+    for(int i = 0; i < count; i++){
+        lines.push_back(generator.line());
+    }
+
+    SimulatedProcesses simulated;
+    if(!posix){
+        processes = &simulated;
+    }
+
+    auto start = chrono::steady_clock::now();
+    for(auto& line : lines){
+        runForInput(parse(line));
+        if(!posix){
+            simulated.finishLine();
+        }
+    }
+    auto elapsed = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+    fprintf(stderr, "%d lines on the %s backend: %.1f ms, %.2f us per line\n", count,
+            posix ? "posix" : "simulated", elapsed * 1000, elapsed * 1e6 / count);
+    if(!posix){
+        auto& stats = simulated.stats();
+        fprintf(stderr, "%lld processes (%lld exec'd), %lld pipes, %lld switches: %.2f us per process\n",
+                stats.processes, stats.execs, stats.pipes, stats.switches, elapsed * 1e6 / stats.processes);
+        for(auto& problem : simulated.problems()){
+            fprintf(stderr, "problem: %s\n", problem.c_str());
+        }
+        processes = posixProcesses();
+    }
+    return 0;
+}
+
+int fuzz(unsigned seed, int count){
+    LineGenerator generator(seed);
+    SimulatedProcesses simulated(seed, 20);
+    processes = &simulated;
+
+    auto failed = 0;
+    for(int i = 0; i < count; i++){
+        auto line = generator.line();
+        options.failFast = generator.pick(2) == 0;
+        runForInput(parse(line));
+
+        if(!simulated.finishLine()){
+            failed++;
+            fprintf(stderr, "line %d%s: %s\n", i, options.failFast ? " (fail-fast)" : "", line.c_str());
+            for(auto& problem : simulated.problems()){
+                fprintf(stderr, "    %s\n", problem.c_str());
+            }
+        }
+        simulated.clearProblems();
+    }
+
+    auto& stats = simulated.stats();
+    fprintf(stderr, "seed %u: %d lines, %lld processes, %lld switches, %lld deadlocks, %d lines with problems\n",
+            seed, count, stats.processes, stats.switches, stats.deadlocks, failed);
+    processes = posixProcesses();
+    return failed == 0 ? 0 : 1;
+}
+
+int main(int argc, char* argv[]){
+    // The write loop, not io_uring setup, the bench is about the orchestration around it
+    options.repeaterIo = FanOutBackend::Blocking;
+    silenceStdout();
+
+    if(argc > 2 && strcmp(argv[1], "--fuzz") == 0){
+        return fuzz(atoi(argv[2]), argc > 3 ? atoi(argv[3]) : 1000);
+    }
+    if(argc > 1 && strcmp(argv[1], "--posix") == 0){
+        return benchmark(true, argc > 2 ? atoi(argv[2]) : 10000);
+    }
+    return benchmark(false, argc > 1 ? atoi(argv[1]) : 10000);
+}
@@ -0,0 +1,342 @@
+#include "budget.h"
+#include <algorithm>
+#include <fstream>
+#include <map>
+#include <sstream>
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+
+using namespace std;
+
+namespace {
+
+// After a branch starts, how long until the group's usage says enough about it to admit the next one
+const int BUDGET_SETTLE_MS = 100;
+// How often an over-budget group's usage is looked at again
+const int BUDGET_POLL_MS = 20;
+// Most parents followed up from a process to find its branch
+const int BUDGET_MAX_DEPTH = 64;
+
+// Numbers the groups' cgroups, so nested groups of one shell get their own
+int cgroupCount = 0;
+
+string readFirstLine(const string& path){
+    ifstream file(path);
+    string line;
+    getline(file, line);
+    return line;
+}
+
+bool writeFile(const string& path, const string& text){
+    auto fd = open(path.c_str(), O_WRONLY | O_CLOEXEC);
+    if(fd < 0){
+        return false;
+    }
+    auto written = write(fd, text.c_str(), text.size());
+    close(fd);
+    return written == (ssize_t)text.size();
+}
+
+// Where the cgroup v2 hierarchy is mounted, empty if it isn't
+string cgroupMount(){
+    ifstream mounts("/proc/self/mountinfo");
+    string line;
+    while(getline(mounts, line)){
+        // The fields after " - " are the filesystem type, source and options; the fifth before it the mount point
+        auto separator = line.find(" - ");
+        if(separator == string::npos || line.compare(separator + 3, 8, "cgroup2 ") != 0){
+            continue;
+        }
+        istringstream fields(line.substr(0, separator));
+        string field;
+        for(int i = 0; i < 5 && fields >> field; i++){
+        }
+        return field;
+    }
+    return "";
+}
+
+// The shell's own cgroup in the v2 hierarchy, relative to the mount
+string ownCgroup(){
+    ifstream groups("/proc/self/cgroup");
+    string line;
+    while(getline(groups, line)){
+        if(line.compare(0, 3, "0::") == 0){
+            return line.substr(3);
+        }
+    }
+    return "";
+}
+
+bool listsMemory(const string& path){
+    istringstream controllers(readFirstLine(path));
+    string controller;
+    while(controllers >> controller){
+        if(controller == "memory"){
+            return true;
+        }
+    }
+    return false;
+}
+
+long long readNumber(const string& path){
+    auto text = readFirstLine(path);
+    return text.empty() ? -1 : atoll(text.c_str());
+}
+
+string branchCgroup(const string& cgroup, int branch){
+    return cgroup + "/b" + to_string(branch);
+}
+
+// The parent of pid from /proc/<pid>/stat, -1 if it's gone
+pid_t parentOf(const char* pid){
+    auto stat = readFirstLine(string("/proc/") + pid + "/stat");
+    // The command name is in parentheses and may have any of them in it, the fields go on after the last
+    auto end = stat.rfind(')');
+    if(end == string::npos){
+        return -1;
+    }
+    istringstream fields(stat.substr(end + 1));
+    string state;
+    long long parent;
+    if(!(fields >> state >> parent)){
+        return -1;
+    }
+    return (pid_t)parent;
+}
+
+long long residentBytes(const char* pid){
+    ifstream status(string("/proc/") + pid + "/status");
+    string line;
+    while(getline(status, line)){
+        if(line.compare(0, 6, "VmRSS:") == 0){
+            return atoll(line.c_str() + 6) * 1024;
+        }
+    }
+    return 0;
+}
+
+string formatSize(long long bytes){
+    char text[32];
+    if(bytes >= 1024LL * 1024 * 1024){
+        snprintf(text, sizeof(text), "%.1f GiB", bytes / (1024.0 * 1024 * 1024));
+    } else if(bytes >= 1024 * 1024){
+        snprintf(text, sizeof(text), "%.1f MiB", bytes / (1024.0 * 1024));
+    } else{
+        snprintf(text, sizeof(text), "%lld KiB", bytes / 1024);
+    }
+    return text;
+}
+
+}
+
+MemoryBudget::MemoryBudget(long long bytes, int branches) : bytes(bytes), pids(branches, -1), held(branches, false),
+                                                             ran(branches, false), peaks(branches, 0){
+    if(!setUpCgroup(branches)){
+        cgroup.clear();
+    }
+}
+
+MemoryBudget::~MemoryBudget(){
+    if(cgroup.empty()){
+        return;
+    }
+    for(size_t i = 0; i < pids.size(); i++){
+        rmdir(branchCgroup(cgroup, (int)i).c_str());
+    }
+    rmdir(cgroup.c_str());
+}
+
+// A cgroup for the group with the memory controller on for its children. The shell's own cgroup has to hand
+// the controller down already: only the cgroups made here get their controllers changed. Sets unavailable to
+// why there's none otherwise.
+bool MemoryBudget::setUpCgroup(int branches){
+    auto mount = cgroupMount();
+    auto own = ownCgroup();
+    if(mount.empty() || own.empty()){
+        unavailable = "no cgroup v2 hierarchy";
+        return false;
+    }
+    auto parent = mount + (own == "/" ? "" : own);
+    if(!listsMemory(parent + "/cgroup.subtree_control")){
+        unavailable = "memory controller not enabled in " + parent + "/cgroup.subtree_control";
+        return false;
+    }
+
+    cgroup = parent + "/eshell-" + to_string(getpid()) + "-" + to_string(cgroupCount++);
+    if(mkdir(cgroup.c_str(), 0755) != 0){
+        unavailable = "can't create " + cgroup + ": " + strerror(errno);
+        return false;
+    }
+    if(!writeFile(cgroup + "/cgroup.subtree_control", "+memory")){
+        unavailable = "can't enable the memory controller in " + cgroup;
+        rmdir(cgroup.c_str());
+        return false;
+    }
+    for(int i = 0; i < branches; i++){
+        auto branch = branchCgroup(cgroup, i);
+        if(mkdir(branch.c_str(), 0755) != 0 || !writeFile(branch + "/memory.max", to_string(bytes))){
+            unavailable = "can't set up " + branch;
+            for(int j = 0; j <= i; j++){
+                rmdir(branchCgroup(cgroup, j).c_str());
+            }
+            rmdir(cgroup.c_str());
+            return false;
+        }
+    }
+    return true;
+}
+
+void MemoryBudget::enter(int branch){
+    if(!cgroup.empty() && writeFile(branchCgroup(cgroup, branch) + "/cgroup.procs", to_string(getpid()))){
+        return;
+    }
+    struct rlimit limit;
+    getrlimit(RLIMIT_AS, &limit);
+    if(limit.rlim_max == RLIM_INFINITY || (long long)limit.rlim_max > bytes){
+        limit.rlim_cur = bytes;
+        setrlimit(RLIMIT_AS, &limit);
+    }
+}
+
+void MemoryBudget::started(int branch, pid_t pid){
+    pids[branch] = pid;
+    ran[branch] = true;
+    lastStart = chrono::steady_clock::now();
+}
+
+void MemoryBudget::finished(int branch, long long peakKilobytes){
+    pids[branch] = -1;
+    peaks[branch] = max(peaks[branch], peakKilobytes * 1024);
+    if(!cgroup.empty()){
+        // Not there before Linux 5.19
+        peaks[branch] = max(peaks[branch], readNumber(branchCgroup(cgroup, branch) + "/memory.peak"));
+    }
+}
+
+bool MemoryBudget::admit(int branch, int running){
+    if(running == 0){
+        return true;
+    }
+    if(usage() >= bytes){
+        held[branch] = true;
+        return false;
+    }
+    return chrono::steady_clock::now() - lastStart >= chrono::milliseconds(BUDGET_SETTLE_MS);
+}
+
+void MemoryBudget::pause() const{
+    usleep(BUDGET_POLL_MS * 1000);
+}
+
+long long MemoryBudget::usage(){
+    if(!cgroup.empty()){
+        auto current = readNumber(cgroup + "/memory.current");
+        if(current >= 0){
+            return current;
+        }
+    }
+    return sampleProcesses();
+}
+
+// The resident memory of the running branches' processes, which also goes into their peaks. A process counts
+// for the branch it descends from, so a branch needn't have a process group of its own. One that was
+// reparented (a daemon it started) isn't counted.
+long long MemoryBudget::sampleProcesses(){
+    map<pid_t, long long> usages;
+    for(auto pid : pids){
+        if(pid > 0){
+            usages[pid] = 0;
+        }
+    }
+    if(usages.empty()){
+        return 0;
+    }
+
+    auto directory = opendir("/proc");
+    if(directory == NULL){
+        return 0;
+    }
+    map<pid_t, pid_t> parents;
+    struct dirent* entry;
+    while((entry = readdir(directory)) != NULL){
+        if(entry->d_name[0] >= '0' && entry->d_name[0] <= '9'){
+            parents[(pid_t)atoi(entry->d_name)] = parentOf(entry->d_name);
+        }
+    }
+    closedir(directory);
+
+    for(auto& process : parents){
+        // Up the tree until a branch, the shell (whose parent isn't a branch either) or the top
+        auto ancestor = process.first;
+        for(int depth = 0; depth < BUDGET_MAX_DEPTH && ancestor > 1 && !usages.count(ancestor); depth++){
+            auto parent = parents.find(ancestor);
+            ancestor = parent != parents.end() ? parent->second : -1;
+        }
+        auto usage = usages.find(ancestor);
+        if(usage != usages.end()){
+            usage->second += residentBytes(to_string(process.first).c_str());
+        }
+    }
+
+    long long total = 0;
+    for(size_t i = 0; i < pids.size(); i++){
+        if(pids[i] > 0){
+            peaks[i] = max(peaks[i], usages[pids[i]]);
+            total += usages[pids[i]];
+        }
+    }
+    return total;
+}
+
+void MemoryBudget::report(const vector<string>& names) const{
+    if(cgroup.empty()){
+        fprintf(stderr, "memory budget %s (RLIMIT_AS, sampled RSS; no cgroup: %s):\n", formatSize(bytes).c_str(),
+                unavailable.c_str());
+    } else{
+        fprintf(stderr, "memory budget %s (cgroup v2):\n", formatSize(bytes).c_str());
+    }
+    int heldCount = 0;
+    for(size_t i = 0; i < peaks.size(); i++){
+        if(!ran[i]){
+            fprintf(stderr, "  %-32s not started\n", names[i].c_str());
+        } else{
+            fprintf(stderr, "  %-32s peak %s%s\n", names[i].c_str(), formatSize(peaks[i]).c_str(),
+                    held[i] ? ", held back" : "");
+        }
+        heldCount += held[i] ? 1 : 0;
+    }
+    fprintf(stderr, "  %d of %d branches held back\n", heldCount, (int)peaks.size());
+}
+
+long long parseMemorySize(const string& text){
+    char* end;
+    errno = 0;
+    auto value = strtoll(text.c_str(), &end, 10);
+    if(end == text.c_str() || errno != 0 || value <= 0){
+        return -1;
+    }
+    string unit = end;
+    if(unit.size() > 1 && (unit.back() == 'B' || unit.back() == 'b')){
+        unit.pop_back();
+    }
+    if(unit.empty()){
+        return value;
+    }
+    if(unit.size() != 1){
+        return -1;
+    }
+    switch(unit[0]){
+        case 'k': case 'K': return value * 1024;
+        case 'm': case 'M': return value * 1024 * 1024;
+        case 'g': case 'G': return value * 1024 * 1024 * 1024;
+        default: return -1;
+    }
+}
@@ -0,0 +1,60 @@
+#ifndef BUDGET_H
+#define BUDGET_H
+
+#include <chrono>
+#include <string>
+#include <vector>
+#include <sys/types.h>
+
+// --memory-budget: how much memory the branches of a parallel group may use together. A branch only starts
+// while the group is under its budget (one always may, so the group can't stall), and no single branch may
+// use more than the whole budget. Each branch's peak is reported when the group is done. A branch's memory
+// only shows some time after it starts, so the next one starts no sooner than BUDGET_SETTLE_MS later.
+//
+// Where the shell's cgroup v2 group hands the memory controller down, the parallel group gets a cgroup with a
+// sub-group per branch: the group's usage is its memory.current, a branch is held to its sub-group's
+// memory.max and its peak is memory.peak. The shell doesn't enable controllers anywhere but in the cgroups it
+// made. Otherwise each branch gets RLIMIT_AS, and the group's usage is the VmRSS of the processes descending
+// from the branches, from /proc/<pid>/status; the report says why there was no cgroup.
+class MemoryBudget {
+public:
+    MemoryBudget(long long bytes, int branches);
+    // Removes the cgroups it created
+    ~MemoryBudget();
+
+    // Called in the branch's own process, before it runs anything
+    void enter(int branch);
+    // The branch is running as pid
+    void started(int branch, pid_t pid);
+    // The branch was reaped. peakKilobytes is the largest resident set the wait reported for it, if any.
+    void finished(int branch, long long peakKilobytes);
+
+    // Whether branch may start now, with running branches already started. Records it as held back if the
+    // group is over its budget.
+    bool admit(int branch, int running);
+    // Waits a moment before asking admit again
+    void pause() const;
+
+    // Each branch's peak and how many were held back, on stderr
+    void report(const std::vector<std::string>& names) const;
+
+private:
+    bool setUpCgroup(int branches);
+    long long usage();
+    long long sampleProcesses();
+
+    long long bytes;
+    // The group's cgroup directory, empty when the fallback is used, and why it is
+    std::string cgroup;
+    std::string unavailable;
+    std::vector<pid_t> pids;
+    std::vector<bool> held;
+    std::vector<bool> ran;
+    std::vector<long long> peaks;
+    std::chrono::steady_clock::time_point lastStart;
+};
+
+// Reads 512K, 64M, 2G or a plain number of bytes. Returns -1 if text is none of those.
+long long parseMemorySize(const std::string& text);
+
+#endif //BUDGET_H
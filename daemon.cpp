@@ -0,0 +1,269 @@
+#include "daemon.h"
+#include "executor.h"
+#include "process.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <algorithm>
+
+using namespace std;
+
+// Longer lines are refused, the parser couldn't hold them anyway
+const uint32_t MAX_DAEMON_LINE = 1024 * 1024;
+const int PASSED_FDS = 3;
+
+static bool socketAddress(const char* path, struct sockaddr_un& address){
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    if(strlen(path) >= sizeof(address.sun_path)){
+        fprintf(stderr, "Socket path is too long: %s\n", path);
+        return false;
+    }
+    strcpy(address.sun_path, path);
+    return true;
+}
+
+static int openSocket(){
+#ifdef SOCK_CLOEXEC
+    return socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+#else
+    auto fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if(fd >= 0){
+        fcntl(fd, F_SETFD, FD_CLOEXEC);
+    }
+    return fd;
+#endif
+}
+
+static bool readAll(int fd, void* data, size_t size){
+    auto bytes = (char*)data;
+    while(size > 0){
+        auto count = read(fd, bytes, size);
+        if(count < 0 && errno == EINTR){
+            continue;
+        }
+        if(count <= 0){
+            return false;
+        }
+        bytes += count;
+        size -= count;
+    }
+    return true;
+}
+
+static bool writeAll(int fd, const void* data, size_t size){
+    auto bytes = (const char*)data;
+    while(size > 0){
+        auto count = write(fd, bytes, size);
+        if(count < 0 && errno == EINTR){
+            continue;
+        }
+        if(count < 0){
+            return false;
+        }
+        bytes += count;
+        size -= count;
+    }
+    return true;
+}
+
+// Reads the request: the length prefix carries the client's fds, the line follows
+static bool receiveRequest(int connection, string& line, int fds[PASSED_FDS]){
+    uint32_t length = 0;
+    char control[CMSG_SPACE(sizeof(int) * PASSED_FDS)];
+    struct iovec part = { &length, sizeof(length) };
+    struct msghdr message;
+    memset(&message, 0, sizeof(message));
+    message.msg_iov = &part;
+    message.msg_iovlen = 1;
+    message.msg_control = control;
+    message.msg_controllen = sizeof(control);
+
+    ssize_t count;
+    int flags = 0;
+#ifdef MSG_CMSG_CLOEXEC
+    flags = MSG_CMSG_CLOEXEC;
+#endif
+    while((count = recvmsg(connection, &message, flags)) < 0 && errno == EINTR);
+    if(count <= 0){
+        return false;
+    }
+
+    int received = 0;
+    for(auto header = CMSG_FIRSTHDR(&message); header != NULL; header = CMSG_NXTHDR(&message, header)){
+        if(header->cmsg_level == SOL_SOCKET && header->cmsg_type == SCM_RIGHTS){
+            received = (header->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+            memcpy(fds, CMSG_DATA(header), sizeof(int) * min(received, PASSED_FDS));
+        }
+    }
+    if(received != PASSED_FDS || (message.msg_flags & MSG_CTRUNC)){
+        fprintf(stderr, "daemon: client sent %d fds, expected %d\n", received, PASSED_FDS);
+        return false;
+    }
+
+    if(count < (ssize_t)sizeof(length) && !readAll(connection, (char*)&length + count, sizeof(length) - count)){
+        return false;
+    }
+    if(length > MAX_DAEMON_LINE){
+        fprintf(stderr, "daemon: line of %u bytes refused\n", length);
+        return false;
+    }
+
+    line.resize(length);
+    return length == 0 || readAll(connection, &line[0], length);
+}
+
+// Runs in the forked copy of the daemon that owns this connection
+static void serveConnection(int connection, DaemonLineRunner runLine){
+    // Children of this copy are waited for as usual
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = SIG_DFL;
+    sigaction(SIGCHLD, &action, NULL);
+
+    string line;
+    int fds[PASSED_FDS];
+    int32_t status = 255;
+
+    if(receiveRequest(connection, line, fds)){
+        for(int i = 0; i < PASSED_FDS; i++){
+            if(fds[i] != i){
+                dup2(fds[i], i);
+            }
+        }
+        for(int i = 0; i < PASSED_FDS; i++){
+            bool usedElsewhere = false;
+            for(int j = 0; j < PASSED_FDS; j++){
+                usedElsewhere = usedElsewhere || fds[i] == j;
+            }
+            if(!usedElsewhere){
+                close(fds[i]);
+            }
+        }
+        // Like runCapturedLine, a line the shell gives up on still sends its status
+        try{
+            status = runLine(line);
+        } catch(const ShellError& error){
+            abandonLine();
+            fprintf(stderr, "ASSERTION FAILED: %s\n", error.what());
+            status = 255;
+        }
+        fflush(NULL);
+    }
+
+    writeAll(connection, &status, sizeof(status));
+    close(connection);
+    _exit(0);
+}
+
+void runDaemon(const char* path, DaemonLineRunner runLine){
+    struct sockaddr_un address;
+    if(!socketAddress(path, address)){
+        return;
+    }
+
+    auto listener = openSocket();
+    if(listener < 0){
+        perror("socket");
+        return;
+    }
+    // A daemon that died leaves its socket file behind
+    unlink(path);
+    if(bind(listener, (struct sockaddr*)&address, sizeof(address)) < 0 || listen(listener, SOMAXCONN) < 0){
+        perror(path);
+        close(listener);
+        return;
+    }
+
+    // Connections are never waited for, don't let them turn into zombies
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = SIG_DFL;
+    action.sa_flags = SA_NOCLDWAIT;
+    sigaction(SIGCHLD, &action, NULL);
+
+    while(true){
+        // Not inherited by the commands the line runs
+#ifdef SOCK_CLOEXEC
+        auto connection = accept4(listener, NULL, NULL, SOCK_CLOEXEC);
+#else
+        auto connection = accept(listener, NULL, NULL);
+        if(connection >= 0){
+            fcntl(connection, F_SETFD, FD_CLOEXEC);
+        }
+#endif
+        if(connection < 0){
+            if(errno != EINTR && errno != ECONNABORTED){
+                perror("accept");
+            }
+            continue;
+        }
+
+        auto pid = fork();
+        if(pid == 0){
+            close(listener);
+            serveConnection(connection, runLine);
+        }
+        if(pid < 0){
+            perror("fork");
+            int32_t status = 255;
+            writeAll(connection, &status, sizeof(status));
+        }
+        close(connection);
+    }
+}
+
+int runClient(const char* path, const string& line){
+    struct sockaddr_un address;
+    if(!socketAddress(path, address)){
+        return 255;
+    }
+
+    auto connection = openSocket();
+    if(connection < 0 || connect(connection, (struct sockaddr*)&address, sizeof(address)) < 0){
+        perror(path);
+        return 255;
+    }
+
+    uint32_t length = line.size();
+    int fds[PASSED_FDS] = { STDIN_FILENO, STDOUT_FILENO, STDERR_FILENO };
+    char control[CMSG_SPACE(sizeof(fds))];
+    memset(control, 0, sizeof(control));
+    struct iovec part = { &length, sizeof(length) };
+    struct msghdr message;
+    memset(&message, 0, sizeof(message));
+    message.msg_iov = &part;
+    message.msg_iovlen = 1;
+    message.msg_control = control;
+    message.msg_controllen = sizeof(control);
+
+    auto header = CMSG_FIRSTHDR(&message);
+    header->cmsg_level = SOL_SOCKET;
+    header->cmsg_type = SCM_RIGHTS;
+    header->cmsg_len = CMSG_LEN(sizeof(fds));
+    memcpy(CMSG_DATA(header), fds, sizeof(fds));
+
+    ssize_t count;
+    while((count = sendmsg(connection, &message, 0)) < 0 && errno == EINTR);
+    if(count < 0 || !writeAll(connection, (const char*)&length + count, sizeof(length) - count) ||
+       !writeAll(connection, line.data(), line.size())){
+        perror("send");
+        close(connection);
+        return 255;
+    }
+
+    int32_t status;
+    if(!readAll(connection, &status, sizeof(status))){
+        fprintf(stderr, "daemon closed the connection without a status\n");
+        status = 255;
+    }
+    close(connection);
+    return status;
+}
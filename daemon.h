@@ -0,0 +1,23 @@
+#ifndef DAEMON_H
+#define DAEMON_H
+
+#include <string>
+
+// Daemon mode: a warm shell listens on a Unix socket and runs lines for clients, so a caller doesn't pay
+// for a fresh process per job. A client sends one line together with its stdin, stdout and stderr
+// (SCM_RIGHTS) and gets the line's exit status back. Every connection is served by a forked copy of the
+// daemon, so clients run concurrently and each one starts from the daemon's caches.
+//
+// Wire format, client to daemon: uint32 line length, then the line; the fds ride on the first byte.
+// Daemon to client: int32 exit status.
+
+// Runs one received line with stdin/stdout/stderr already redirected to the client's, returns its status
+typedef int (*DaemonLineRunner)(std::string& line);
+
+// Serves connections until the process is killed. Returns only if the socket can't be set up.
+void runDaemon(const char* path, DaemonLineRunner runLine);
+
+// Sends line with this process's stdin/stdout/stderr and returns the status the daemon reports
+int runClient(const char* path, const std::string& line);
+
+#endif //DAEMON_H
@@ -0,0 +1,145 @@
+#include "diagnostics.h"
+#include "parser.h"
+#include <atomic>
+#include <cstddef>
+#include <unistd.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/resource.h>
+
+using namespace std;
+
+static atomic<long> liveHeapBytes(0);
+static atomic<long> liveHeapBlocks(0);
+static atomic<long> totalAllocations(0);
+static atomic<long> liveChildren(0);
+static atomic<long> linesRun(0);
+static atomic<long> lineStartAllocations(0);
+static atomic<long> lastLineAllocations(0);
+static int fdLimit = 1024;
+
+// Set once the allocator replacements of diagnostics_alloc.cpp report anything. Without them (a program
+// embedding libeshell.a keeps its own allocator) only the parser's allocations are counted.
+static atomic<bool> heapTracked(false);
+
+void heapAllocated(size_t size){
+    liveHeapBytes += size;
+    liveHeapBlocks++;
+    totalAllocations++;
+    heapTracked.store(true, memory_order_relaxed);
+}
+
+void heapFreed(size_t size){
+    liveHeapBytes -= size;
+    liveHeapBlocks--;
+}
+
+static void onSignal(int){
+    dumpDiagnostics(STDERR_FILENO);
+}
+
+void diagnosticsInit(){
+    struct rlimit limit;
+    if(getrlimit(RLIMIT_NOFILE, &limit) == 0 && limit.rlim_cur != RLIM_INFINITY){
+        fdLimit = limit.rlim_cur < 65536 ? (int)limit.rlim_cur : 65536;
+    }
+
+    struct sigaction action;
+    action.sa_handler = onSignal;
+    sigemptyset(&action.sa_mask);
+    // Don't let a dump interrupt reads and waits
+    action.sa_flags = SA_RESTART;
+    sigaction(SIGUSR1, &action, NULL);
+}
+
+void childStarted(){
+    liveChildren++;
+}
+
+void childReaped(){
+    liveChildren--;
+}
+
+static long allAllocations(){
+    long parserLive, parserBlocks, parserTotal;
+    parser_allocation_stats(&parserLive, &parserBlocks, &parserTotal);
+    return totalAllocations + parserTotal;
+}
+
+void lineStarted(){
+    lineStartAllocations = allAllocations();
+}
+
+void lineFinished(){
+    lastLineAllocations = allAllocations() - lineStartAllocations;
+    linesRun++;
+}
+
+static int countOpenFds(){
+    int count = 0;
+    for(int fd = 0; fd < fdLimit; fd++){
+        if(fcntl(fd, F_GETFD) != -1){
+            count++;
+        }
+    }
+    return count;
+}
+
+// snprintf isn't async-signal-safe, so numbers are formatted by hand
+static void append(char* buffer, size_t& used, size_t size, const char* text){
+    while(*text && used + 1 < size){
+        buffer[used++] = *text++;
+    }
+}
+
+static void append(char* buffer, size_t& used, size_t size, long value){
+    char digits[24];
+    int count = 0;
+    bool negative = value < 0;
+    unsigned long magnitude = negative ? -(unsigned long)value : value;
+
+    do{
+        digits[count++] = '0' + magnitude % 10;
+        magnitude /= 10;
+    } while(magnitude > 0);
+
+    if(negative){
+        append(buffer, used, size, "-");
+    }
+    while(count > 0 && used + 1 < size){
+        buffer[used++] = digits[--count];
+    }
+}
+
+void dumpDiagnostics(int fd){
+    long parserLive, parserBlocks, parserTotal;
+    parser_allocation_stats(&parserLive, &parserBlocks, &parserTotal);
+
+    char buffer[512];
+    size_t used = 0;
+    append(buffer, used, sizeof(buffer), "stats: pid ");
+    append(buffer, used, sizeof(buffer), (long)getpid());
+    append(buffer, used, sizeof(buffer), ", open fds ");
+    append(buffer, used, sizeof(buffer), (long)countOpenFds());
+    append(buffer, used, sizeof(buffer), ", live heap ");
+    append(buffer, used, sizeof(buffer), liveHeapBytes + parserLive);
+    append(buffer, used, sizeof(buffer), " bytes in ");
+    append(buffer, used, sizeof(buffer), liveHeapBlocks + parserBlocks);
+    append(buffer, used, sizeof(buffer), heapTracked ? " blocks" : " blocks (parser only)");
+    append(buffer, used, sizeof(buffer), ", live children ");
+    append(buffer, used, sizeof(buffer), liveChildren.load());
+    append(buffer, used, sizeof(buffer), ", lines ");
+    append(buffer, used, sizeof(buffer), linesRun.load());
+    append(buffer, used, sizeof(buffer), ", allocations in last line ");
+    append(buffer, used, sizeof(buffer), lastLineAllocations.load());
+    append(buffer, used, sizeof(buffer), "\n");
+
+    size_t written = 0;
+    while(written < used){
+        auto result = write(fd, buffer + written, used - written);
+        if(result <= 0){
+            break;
+        }
+        written += result;
+    }
+}
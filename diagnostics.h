@@ -0,0 +1,26 @@
+#ifndef DIAGNOSTICS_H
+#define DIAGNOSTICS_H
+
+#include <stddef.h>
+
+// Resource accounting for a long running shell: open fds, live heap, live children and
+// allocations per line. Dumped by the "stats" builtin and on SIGUSR1.
+
+void diagnosticsInit();
+
+void childStarted();
+void childReaped();
+
+// Brackets one input line so its allocation count can be reported
+void lineStarted();
+void lineFinished();
+
+// Called by the operator new and delete replacements, which only the eshell executable links (see
+// diagnostics_alloc.cpp): a library mustn't replace its host program's allocator
+void heapAllocated(size_t size);
+void heapFreed(size_t size);
+
+// Only uses async-signal-safe calls, so the SIGUSR1 handler can call it directly
+void dumpDiagnostics(int fd);
+
+#endif //DIAGNOSTICS_H
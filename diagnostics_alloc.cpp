@@ -0,0 +1,70 @@
+#include "diagnostics.h"
+#include <new>
+#include <cstddef>
+#include <stdlib.h>
+
+using namespace std;
+
+// Replaces the global operator new and delete to feed the live heap counts of diagnostics.cpp. Linked into
+// the eshell executable only, never into libeshell.a, where it would take over the allocator of every
+// program embedding the library.
+
+// Every C++ allocation carries its size in front of it so frees can be accounted for
+static const size_t HEADER_SIZE = alignof(max_align_t) > sizeof(size_t) ? alignof(max_align_t) : sizeof(size_t);
+
+static void* trackedAlloc(size_t size){
+    auto block = (char*)malloc(size + HEADER_SIZE);
+    if(block == NULL){
+        return NULL;
+    }
+
+    *(size_t*)block = size;
+    heapAllocated(size);
+    return block + HEADER_SIZE;
+}
+
+static void trackedFree(void* ptr){
+    if(ptr == NULL){
+        return;
+    }
+
+    auto block = (char*)ptr - HEADER_SIZE;
+    heapFreed(*(size_t*)block);
+    free(block);
+}
+
+void* operator new(size_t size){
+    auto ptr = trackedAlloc(size);
+    if(ptr == NULL){
+        throw bad_alloc();
+    }
+    return ptr;
+}
+
+void* operator new[](size_t size){
+    return operator new(size);
+}
+
+void* operator new(size_t size, const nothrow_t&) noexcept{
+    return trackedAlloc(size);
+}
+
+void* operator new[](size_t size, const nothrow_t&) noexcept{
+    return trackedAlloc(size);
+}
+
+void operator delete(void* ptr) noexcept{
+    trackedFree(ptr);
+}
+
+void operator delete[](void* ptr) noexcept{
+    trackedFree(ptr);
+}
+
+void operator delete(void* ptr, const nothrow_t&) noexcept{
+    trackedFree(ptr);
+}
+
+void operator delete[](void* ptr, const nothrow_t&) noexcept{
+    trackedFree(ptr);
+}
@@ -0,0 +1,155 @@
+#include "embed.h"
+#include "executor.h"
+#include <iostream>
+#include <chrono>
+#include <vector>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+
+using namespace std;
+
+namespace {
+
+// Holds the line's stdin, stdout or stderr. A memfd where there is one, an unlinked temporary file otherwise.
+int anonymousFile(const char* name){
+#ifdef MFD_CLOEXEC
+    auto memfd = memfd_create(name, MFD_CLOEXEC);
+    if(memfd >= 0){
+        return memfd;
+    }
+#else
+    (void)name;
+#endif
+    char path[] = "/tmp/eshell-XXXXXX";
+    // Close-on-exec from the start, the host may fork on another thread meanwhile
+    auto fd = mkostemp(path, O_CLOEXEC);
+    if(fd >= 0){
+        unlink(path);
+    }
+    return fd;
+}
+
+bool writeAll(int fd, const string& data){
+    size_t done = 0;
+    while(done < data.size()){
+        auto count = write(fd, data.data() + done, data.size() - done);
+        if(count < 0 && errno == EINTR){
+            continue;
+        }
+        if(count < 0){
+            return false;
+        }
+        done += count;
+    }
+    return lseek(fd, 0, SEEK_SET) == 0;
+}
+
+string readAll(int fd){
+    string data;
+    struct stat st;
+    if(fstat(fd, &st) != 0){
+        return data;
+    }
+    data.resize(st.st_size);
+
+    size_t done = 0;
+    while(done < data.size()){
+        auto count = pread(fd, &data[done], data.size() - done, done);
+        if(count < 0 && errno == EINTR){
+            continue;
+        }
+        if(count <= 0){
+            break;
+        }
+        done += count;
+    }
+    data.resize(done);
+    return data;
+}
+
+long long childCpuMilliseconds(){
+    struct rusage usage;
+    getrusage(RUSAGE_CHILDREN, &usage);
+    return (usage.ru_utime.tv_sec + usage.ru_stime.tv_sec) * 1000LL +
+           (usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) / 1000;
+}
+
+}
+
+CapturedLine runCapturedLine(const string& line, const string& input){
+    CapturedLine result;
+    result.status = 0;
+    result.milliseconds = 0;
+    result.cpuMilliseconds = 0;
+
+    vector<char> text(line.begin(), line.end());
+    text.push_back('\0');
+    auto parsed = new parsed_input;
+    char error[PARSE_ERROR_SIZE];
+    if(!parse_line_r(text.data(), parsed, error, sizeof(error)) || parsed->num_inputs == 0){
+        free_parsed_input(parsed);
+        delete parsed;
+        result.status = 2;
+        result.error = error[0] ? error : "parse error";
+        return result;
+    }
+
+    int files[3] = { anonymousFile("eshell-stdin"), anonymousFile("eshell-stdout"), anonymousFile("eshell-stderr") };
+    if(files[0] < 0 || files[1] < 0 || files[2] < 0 || !writeAll(files[0], input)){
+        result.status = 255;
+        result.error = string("capture: ") + strerror(errno);
+        for(auto fd : files){
+            if(fd >= 0){
+                close(fd);
+            }
+        }
+        free_parsed_input(parsed);
+        delete parsed;
+        return result;
+    }
+
+    // Anything still buffered for the caller's stdout goes out before the fd changes under it
+    cout << flush;
+    fflush(stdout);
+    int saved[3];
+    for(int fd = 0; fd < 3; fd++){
+        saved[fd] = fcntl(fd, F_DUPFD_CLOEXEC, 3);
+        dup2(files[fd], fd);
+    }
+
+    auto started = chrono::steady_clock::now();
+    auto cpuBefore = childCpuMilliseconds();
+    try{
+        result.status = runLine(parsed);
+    } catch(const ShellError& shellError){
+        abandonLine();
+        result.status = 255;
+        result.error = shellError.what();
+    }
+    result.milliseconds = chrono::duration_cast<chrono::milliseconds>(chrono::steady_clock::now() - started).count();
+    result.cpuMilliseconds = childCpuMilliseconds() - cpuBefore;
+
+    cout << flush;
+    fflush(stdout);
+    for(int fd = 0; fd < 3; fd++){
+        if(saved[fd] >= 0){
+            dup2(saved[fd], fd);
+            close(saved[fd]);
+        } else{
+            close(fd);
+        }
+    }
+
+    result.out = readAll(files[1]);
+    result.err = readAll(files[2]);
+    for(auto fd : files){
+        close(fd);
+    }
+    return result;
+}
@@ -0,0 +1,30 @@
+#ifndef EMBED_H
+#define EMBED_H
+
+#include <string>
+
+// Running lines from another program: link libeshell.a (the parser and the executor, everything but the
+// shell's main) and call runCapturedLine instead of starting an eshell and parsing what it prints.
+// Set options (executor.h) before the first call to get the shell's flags.
+//
+// The line borrows the calling process's fds 0, 1 and 2 while it runs, so only one line can run at a time
+// and no other thread should use them meanwhile. Only the processes the line starts are waited for, the
+// caller's own children are left to it.
+
+struct CapturedLine {
+    // The line's exit status like the shell reports it: 2 if it didn't parse, 255 if the shell gave up on it
+    int status;
+    // Why the line didn't parse or why the shell gave up on it, empty if it ran
+    std::string error;
+    // What the line wrote to stdout and stderr
+    std::string out;
+    std::string err;
+    // Wall clock time of the line, and CPU time (user + system) of the processes it started
+    long long milliseconds;
+    long long cpuMilliseconds;
+};
+
+// Runs line with input as its stdin. Never exits the caller: every error comes back in the result.
+CapturedLine runCapturedLine(const std::string& line, const std::string& input);
+
+#endif //EMBED_H
@@ -0,0 +1,1207 @@
+#include <iostream>
+#include <string>
+#include "executor.h"
+#include "process.h"
+#include "meter.h"
+#include "diagnostics.h"
+#include "fdtable.h"
+#include "expansion.h"
+#include "shard.h"
+#include "optimizer.h"
+#include "fanin.h"
+#include "spool.h"
+#include "budget.h"
+#include <sys/types.h>
+#include <unistd.h>
+#include <vector>
+#include <fcntl.h>
+#include <sys/wait.h>
+#include <signal.h>
+#include <poll.h>
+#include <sys/stat.h>
+#include <string.h>
+
+using namespace std;
+
+struct SubshellArgs{
+    char str[INPUT_BUFFER_SIZE];
+};
+
+// Points into the parsed_input the command came from, valid as long as that is
+struct CommandArgs{
+    // The parsed command, expanded right before its stage starts
+    command* cmd;
+    char** args;
+    // Stdin comes from this file instead, see command.input_file
+    const char* inputFile;
+};
+
+struct CommandSubshellArgs{
+    bool isCommand;
+    // A subshell written as [...]: its commands split the input between them instead of each getting all of it
+    bool isShard;
+    CommandArgs commandArgs;
+    SubshellArgs subshellArgs;
+};
+
+struct PipelineArgs {
+    CommandSubshellArgs commands[MAX_INPUTS];
+    int count;
+};
+ShellOptions options;
+
+void assert(bool condition, string message){
+    if(!condition){
+        throw ShellError(message);
+    }
+}
+
+parsed_input* parseInput(char* str){
+    parsed_input* ptr = new parsed_input;
+    auto parse_success = parse_line(str, ptr);
+    assert(parse_success, "parse error");
+    auto inputCount = ptr->num_inputs;
+    assert(inputCount > 0, "inputCount");
+    return ptr;
+}
+
+int runForInput(parsed_input* ptr);
+int runPipeline(const PipelineArgs& input);
+
+// Children this process started and hasn't reaped, for abandonLine
+vector<pid_t> unreapedChildren;
+
+void forgetChild(pid_t pid){
+    for(size_t i = 0; i < unreapedChildren.size(); i++){
+        if(unreapedChildren[i] == pid){
+            unreapedChildren.erase(unreapedChildren.begin() + i);
+            break;
+        }
+    }
+    childReaped();
+}
+
+// Runs child in a new process and returns its pid. What the child returns is its exit status.
+// role says what the process is for, see ProcessBackend::start.
+pid_t startChild(const char* role, const function<int()>& child){
+    auto pid = processes->start(role, child);
+    assert(pid >= 0, "fork");
+    childStarted();
+    unreapedChildren.push_back(pid);
+    return pid;
+}
+
+// Both ends are close-on-exec and tracked in shellFds
+void pipe(int& read, int& write){
+    auto result = processes->openPipe(read, write);
+    assert(result, "pipe error");
+}
+
+
+void closeFile(int fd){
+    auto result = processes->close(fd);
+    assert(result >= 0, "close error");
+}
+
+// For children that keep running shell code instead of exec'ing: drop the pipe ends inherited from us
+void closeInheritedFds(){
+    processes->closeInherited();
+}
+
+// Exit code of the child, or 128 + signal number if it was killed, like other shells report it
+int exitStatus(int status){
+    if(WIFEXITED(status)){
+        return WEXITSTATUS(status);
+    } else if(WIFSIGNALED(status)){
+        cout << "Child exited with signal: " << WTERMSIG(status) << endl;
+        return 128 + WTERMSIG(status);
+    }
+
+    return status;
+}
+
+int waitForChildProcess(pid_t pid){
+    int status;
+    while(processes->wait(pid, status) < 0){
+        if(errno != EINTR){
+            // Nothing to wait for, report it as a failure instead of taking the shell down
+            fprintf(stderr, "waitpid failed: %s\n", strerror(errno));
+            return 255;
+        }
+    }
+
+    forgetChild(pid);
+    return exitStatus(status);
+}
+
+// Duplicates the file descriptor, old and new file descriptors can be used interchangeably.
+void self_dup2(int a, int b){
+    auto result = processes->dup2(a, b);
+    assert(result >= 0 , "dup error");
+}
+
+void redirect(int fd1, int fd2){
+    self_dup2(fd1, fd2);
+    closeFile(fd1);
+}
+
+void redirectInput(int readFd, int currentInFd){
+    redirect(readFd, currentInFd);
+}
+
+void redirectOutput(int writeFd, int currentOutFd){
+    redirect(writeFd, currentOutFd);
+}
+
+// After the call to this, writing to stdout goes to writefd. Writefd can be deleted.
+void redirectStdout(int writeFd){
+    redirectOutput(writeFd, STDOUT_FILENO);
+}
+
+// After the call to this, stdin reads what's been written to readfd. Readfd can be deleted.
+void redirectStdin(int readFd){
+    redirectInput(readFd, STDIN_FILENO);
+}
+
+void runCommand(char* args[]){
+    processes->exec(args);
+
+    // Execvp shouldn't return
+    assert(false, "execvp error");
+}
+
+// Stdin from a file, for commands the optimizer took out of "cat file | command". If the file went away
+// since, the command still runs, on no input and after cat's message, the way it would have behind cat.
+void redirectInputFile(const char* path){
+    auto fd = processes->open(path, O_RDONLY | O_CLOEXEC);
+    if(fd < 0){
+        fprintf(stderr, "cat: %s: %s\n", path, strerror(errno));
+        fd = processes->open("/dev/null", O_RDONLY | O_CLOEXEC);
+        assert(fd >= 0, "open /dev/null");
+    }
+    redirectStdin(fd);
+}
+
+// The arguments to exec, after wildcard expansion if anything was expanded
+char** argumentsOf(command& cmd){
+    return cmd.argv != NULL ? cmd.argv : cmd.args;
+}
+
+void runCommand(command& cmd){
+    if(cmd.input_file != NULL){
+        redirectInputFile(cmd.input_file);
+    }
+    runCommand(argumentsOf(cmd));
+}
+
+void copyInPlace(char* src, char* dst, int count){
+    memcpy(dst, src, count);
+}
+
+void getCommand(single_input& input, CommandSubshellArgs& result){
+    auto type = input.type;
+
+    result.isShard = type == INPUT_TYPE_SHARD;
+    if(type == INPUT_TYPE_COMMAND){
+        result.isCommand = true;
+        result.commandArgs.cmd = &input.data.cmd;
+        result.commandArgs.args = argumentsOf(input.data.cmd);
+        result.commandArgs.inputFile = input.data.cmd.input_file;
+    } else if(type == INPUT_TYPE_SUBSHELL || type == INPUT_TYPE_SHARD){
+        result.isCommand = false;
+        copyInPlace(input.data.subshell, result.subshellArgs.str, INPUT_BUFFER_SIZE);
+    } else{
+        assert(false, "getpipelineargs-2");
+    }
+}
+
+PipelineArgs getPipeline(pipeline& pipeline){
+    PipelineArgs result;
+    result.count = pipeline.num_commands;
+
+    for(int i = 0; i < result.count; i++){
+        result.commands[i].isCommand = true;
+        result.commands[i].isShard = false;
+        result.commands[i].commandArgs.cmd = &pipeline.commands[i];
+        result.commands[i].commandArgs.args = argumentsOf(pipeline.commands[i]);
+        result.commands[i].commandArgs.inputFile = pipeline.commands[i].input_file;
+    }
+
+    return result;
+}
+
+PipelineArgs getPipeline(parsed_input* parsed_input){
+    assert(parsed_input->separator == SEPARATOR_PIPE, "getpipelineargs-1");
+    auto count = (int)parsed_input->num_inputs;
+    PipelineArgs result;
+    result.count = count;
+
+    for(int i = 0; i < count; i++){
+        auto& input = parsed_input->inputs[i];
+        getCommand(input, result.commands[i]);
+    }
+
+    return result;
+}
+
+// Blocks substitution output is read in
+const size_t CAPTURE_BLOCK_SIZE = 64 * 1024;
+
+// One running $(...): its stdout goes to a memfd (or a pipe where there is none)
+struct Capture {
+    pid_t pid = 0;
+    int fd = -1;
+    bool isMemfd = false;
+    string output;
+};
+
+// Reads what the pipe-backed captures write while they run, a pipe holds too little to wait for them first
+void drainCapturePipes(vector<Capture>& captures){
+    vector<char> block(CAPTURE_BLOCK_SIZE);
+    vector<struct pollfd> open;
+    vector<Capture*> owners;
+    for(auto& capture : captures){
+        if(!capture.isMemfd){
+            open.push_back({capture.fd, POLLIN, 0});
+            owners.push_back(&capture);
+        }
+    }
+
+    while(!open.empty()){
+        if(poll(open.data(), open.size(), -1) < 0){
+            assert(errno == EINTR, "substitution-poll");
+            continue;
+        }
+        for(size_t i = 0; i < open.size();){
+            ssize_t count = 0;
+            if(open[i].revents != 0){
+                count = read(open[i].fd, block.data(), block.size());
+                if(count > 0){
+                    owners[i]->output.append(block.data(), count);
+                }
+            }
+            if(open[i].revents != 0 && count <= 0 && !(count < 0 && errno == EINTR)){
+                closeFile(open[i].fd);
+                open.erase(open.begin() + i);
+                owners.erase(owners.begin() + i);
+            } else{
+                i++;
+            }
+        }
+    }
+}
+
+// The child wrote into the memfd and is done, read it back from the start in large blocks
+void readCaptureMemfd(Capture& capture){
+    struct stat st;
+    assert(fstat(capture.fd, &st) == 0, "substitution-stat");
+    capture.output.resize(st.st_size);
+
+    size_t done = 0;
+    while(done < capture.output.size()){
+        auto count = pread(capture.fd, &capture.output[done], min(capture.output.size() - done, CAPTURE_BLOCK_SIZE), done);
+        if(count < 0 && errno == EINTR){
+            continue;
+        }
+        assert(count >= 0, "substitution-read");
+        if(count == 0){
+            break;
+        }
+        done += count;
+    }
+    capture.output.resize(done);
+    closeFile(capture.fd);
+}
+
+// Runs every $(...) of a line at the same time and returns their outputs in order
+vector<string> captureSubstitutions(const vector<string>& commands){
+    vector<Capture> captures(commands.size());
+
+    for(size_t i = 0; i < commands.size(); i++){
+        // Parsed here first, a bad substitution is a parse error of the line. The child parses its own copy.
+        vector<char> text(commands[i].begin(), commands[i].end());
+        text.push_back('\0');
+        auto input = parseInput(text.data());
+        free_parsed_input(input);
+        delete input;
+
+        int readFd = -1, writeFd = -1;
+        auto& capture = captures[i];
+        capture.fd = processes->openMemoryFile("eshell-substitution");
+        capture.isMemfd = capture.fd >= 0;
+        writeFd = capture.fd;
+        if(!capture.isMemfd){
+            pipe(readFd, writeFd);
+            capture.fd = readFd;
+        }
+
+        capture.pid = startChild("substitution", [=]() mutable -> int{
+            redirectStdout(writeFd);
+            closeInheritedFds();
+            return runForInput(parseInput(text.data()));
+        });
+
+        if(!capture.isMemfd){
+            closeFile(writeFd);
+        }
+    }
+
+    drainCapturePipes(captures);
+
+    vector<string> outputs;
+    for(auto& capture : captures){
+        waitForChildProcess(capture.pid);
+        if(capture.isMemfd){
+            readCaptureMemfd(capture);
+        }
+        outputs.push_back(capture.output);
+    }
+    return outputs;
+}
+
+// Substitutions and wildcards, right before the command starts: after the steps before it ran, and not at
+// all if it doesn't
+void expandCommand(command& cmd){
+    if(!options.explainOnly){
+        expandCommand(cmd, captureSubstitutions);
+    }
+}
+
+// Size of the blocks the repeater reads from its producer and hands to every consumer
+const size_t REPEATER_CHUNK_SIZE = 256 * 1024;
+
+// Returns how many consumers are still reading. One whose write failed has closed its end (exited, like head
+// does after its lines), so its pipe is closed and it gets nothing more; the others go on as before.
+int broadcastChunk(FanOutWriter* writer, const char* data, size_t size, vector<int>& fds, vector<bool>& failed){
+    writer->broadcast(data, size, fds, failed);
+
+    auto reading = 0;
+    for(size_t i = 0; i < failed.size(); i++){
+        if(failed[i] && fds[i] >= 0){
+            closeFile(fds[i]);
+            fds[i] = -1;
+        }
+        if(!failed[i]){
+            reading++;
+        }
+    }
+    return reading;
+}
+
+// Streams the producer's output to every consumer block by block. Returns how many still read at the end.
+// Consumers see the input line by line as before, so an unterminated last line still gets its newline.
+int broadcastToConsumers(vector<int>& consumerFds){
+    auto writer = createFanOutWriter(options.repeaterIo);
+    vector<bool> failed(consumerFds.size(), false);
+    vector<char> chunk(REPEATER_CHUNK_SIZE);
+    char lastChar = '\n';
+    auto reading = (int)consumerFds.size();
+
+    while(reading > 0){
+        auto count = processes->read(STDIN_FILENO, chunk.data(), chunk.size());
+        if(count < 0 && errno == EINTR){
+            continue;
+        }
+        assert(count >= 0, "repeater-read");
+        if(count == 0){
+            break;
+        }
+
+        lastChar = chunk[count - 1];
+        reading = broadcastChunk(writer, chunk.data(), count, consumerFds, failed);
+    }
+
+    if(reading > 0 && lastChar != '\n'){
+        broadcastChunk(writer, "\n", 1, consumerFds, failed);
+    }
+
+    delete writer;
+    return reading;
+}
+
+// --repeater-spool: the producer's output is written once into a spool and every consumer is fed from it at
+// its own pace (see spool.h). The feeders close the consumer pipes, consumerFds are all -1 afterwards.
+int spoolToConsumers(vector<int>& consumerFds){
+    for(auto fd : consumerFds){
+        shellFds.forget(fd);
+    }
+    RepeaterSpool spool(consumerFds);
+    consumerFds.assign(consumerFds.size(), -1);
+    assert(spool.start(), "repeater-spool");
+
+    vector<char> chunk(REPEATER_CHUNK_SIZE);
+    char lastChar = '\n';
+    while(spool.reading() > 0){
+        auto count = processes->read(STDIN_FILENO, chunk.data(), chunk.size());
+        if(count < 0 && errno == EINTR){
+            continue;
+        }
+        assert(count >= 0, "repeater-read");
+        if(count == 0){
+            break;
+        }
+
+        lastChar = chunk[count - 1];
+        assert(spool.append(chunk.data(), count), "repeater-spool");
+    }
+
+    if(lastChar != '\n'){
+        assert(spool.append("\n", 1), "repeater-spool");
+    }
+
+    // Whoever still reads gets the rest from the spool, the producer doesn't wait for them
+    auto reading = spool.reading();
+    spool.finish();
+    return reading;
+}
+
+// --fan-in: a group's branches write into pipes of their own, merged line by line into our stdout
+struct BranchOutputs {
+    bool merge;
+    vector<int> readFds;
+    vector<string> tags;
+};
+
+// The write end a branch gets as its stdout, -1 if it shares ours
+int openBranchOutput(BranchOutputs& outputs, const string& tag){
+    if(!outputs.merge){
+        return -1;
+    }
+
+    int readFd, writeFd;
+    pipe(readFd, writeFd);
+    outputs.readFds.push_back(readFd);
+    if(options.fanInTag){
+        outputs.tags.push_back(tag);
+    }
+    return writeFd;
+}
+
+// Starts forwarding once every branch is running, NULL if nothing is merged
+FanInMerger* startMerger(BranchOutputs& outputs){
+    if(!outputs.merge){
+        return NULL;
+    }
+
+    for(auto fd : outputs.readFds){
+        // The merger closes them when it's done
+        shellFds.forget(fd);
+    }
+    auto merger = new FanInMerger(outputs.readFds, outputs.tags, STDOUT_FILENO);
+    merger->start();
+    return merger;
+}
+
+void finishMerger(FanInMerger* merger){
+    if(merger != NULL){
+        merger->join();
+        delete merger;
+    }
+}
+
+string describeCommand(command& cmd){
+    string text;
+    for(auto args = argumentsOf(cmd); *args != NULL; args++){
+        text += (text.empty() ? "" : " ") + string(*args);
+    }
+    return text;
+}
+
+string describeInput(single_input& input){
+    if(input.type == INPUT_TYPE_SUBSHELL){
+        return "(" + string(input.data.subshell) + ")";
+    }
+    if(input.type == INPUT_TYPE_COMMAND){
+        return describeCommand(input.data.cmd);
+    }
+    string text;
+    for(int i = 0; i < input.data.pline.num_commands; i++){
+        text += (i == 0 ? "" : " | ") + describeCommand(input.data.pline.commands[i]);
+    }
+    return text;
+}
+
+// With repeatInput false (a group at the head of a pipeline) the consumers read our stdin themselves
+int runRepeater(parsed_input* input, bool mergeOutput, bool repeatInput){
+    assert(input->separator == SEPARATOR_PARA, "repeater");
+
+    // cout << "RunRepeater" << endl;
+    // We're already forked and piped (previous process is sending input to us)
+
+    auto inputCount = input->num_inputs;
+    auto pipeReadFds = new int[inputCount];
+    auto pipeWriteFds = new int[inputCount];
+
+    vector<pid_t> childPids;
+    BranchOutputs outputs;
+    outputs.merge = mergeOutput;
+
+    for(int i = 0; i < inputCount; i++){
+        auto type = input->inputs[i].type;
+        assert(type == INPUT_TYPE_COMMAND, "repeater-2");
+        expandCommand(input->inputs[i].data.cmd);
+        auto args = argumentsOf(input->inputs[i].data.cmd);
+
+        auto readFd = -1;
+        if(repeatInput){
+            pipe(pipeReadFds[i], pipeWriteFds[i]);
+            readFd = pipeReadFds[i];
+        }
+        auto outputFd = openBranchOutput(outputs, describeCommand(input->inputs[i].data.cmd));
+
+        // Rep->A, Rep->B, Rep->C
+        auto childPid = startChild("repeater consumer", [=]() -> int{
+            // A, B, C, Receives from Repeater
+            // The other consumers' write ends are close-on-exec, so they can't hide EOF from them
+            if(readFd >= 0){
+                redirectStdin(readFd);
+            }
+            if(outputFd >= 0){
+                redirectStdout(outputFd);
+            }
+
+            runCommand(args);
+            return 0;
+        });
+
+        // Repeater program
+        childPids.push_back(childPid);
+        // Only the consumer reads from it
+        if(readFd >= 0){
+            closeFile(readFd);
+        }
+        if(outputFd >= 0){
+            closeFile(outputFd);
+        }
+    }
+
+    auto merger = startMerger(outputs);
+    if(!repeatInput){
+        auto result = 0;
+        for(auto childPid : childPids){
+            auto status = waitForChildProcess(childPid);
+            if(result == 0){
+                result = status;
+            }
+        }
+        finishMerger(merger);
+        delete[] pipeReadFds;
+        delete[] pipeWriteFds;
+        return result;
+    }
+
+    // A consumer that exits early must show up as a failed write, not kill the repeater and starve the others.
+    // Set only now, the consumers are already started and an exec'd command keeps an ignored signal.
+    signal(SIGPIPE, SIG_IGN);
+
+    vector<int> consumerFds(pipeWriteFds, pipeWriteFds + inputCount);
+    auto reading = options.repeaterSpool ? spoolToConsumers(consumerFds) : broadcastToConsumers(consumerFds);
+
+    // Every consumer is gone: stop reading, so the producer's next write fails and it stops as well
+    // instead of producing the rest of its output for nobody
+    if(reading == 0){
+        processes->close(STDIN_FILENO);
+    }
+
+    // Close files for eof
+    for(auto fd : consumerFds){
+        if(fd >= 0){
+            closeFile(fd);
+        }
+    }
+
+    int result = 0;
+    auto childCount = (int)childPids.size();
+    for(int i = 0; i < childCount; i++){
+        // cout << "Waiting for child..." << childPids[i] << endl;
+        auto status = waitForChildProcess(childPids[i]);
+        if(result == 0){
+            result = status;
+        }
+        // cout << "One child process exited: " << childPids[i] << endl;
+    }
+    finishMerger(merger);
+
+    delete[] pipeReadFds;
+    delete[] pipeWriteFds;
+
+    return result;
+}
+
+// Like the repeater, but each line of the producer's output goes to exactly one of the consumers,
+// picked by spec.policy. Consumers may be commands or pipelines.
+int runSharder(parsed_input* input, const ShardSpec& spec, bool mergeOutput){
+    assert(input->separator == SEPARATOR_PARA, "sharder");
+
+    auto inputCount = input->num_inputs;
+    vector<int> workerFds;
+    vector<pid_t> childPids;
+    BranchOutputs outputs;
+    outputs.merge = mergeOutput;
+
+    for(int i = 0; i < inputCount; i++){
+        auto type = input->inputs[i].type;
+        assert(type == INPUT_TYPE_COMMAND || type == INPUT_TYPE_PIPELINE, "sharder-2");
+
+        int readFd, writeFd;
+        pipe(readFd, writeFd);
+
+        auto& worker = input->inputs[i];
+        // A pipeline worker's stages are expanded as they start
+        if(type == INPUT_TYPE_COMMAND){
+            expandCommand(worker.data.cmd);
+        }
+        auto outputFd = openBranchOutput(outputs, describeInput(worker));
+
+        auto childPid = startChild("shard worker", [=, &worker]() -> int{
+            redirectStdin(readFd);
+            if(outputFd >= 0){
+                redirectStdout(outputFd);
+            }
+
+            if(type == INPUT_TYPE_COMMAND){
+                runCommand(worker.data.cmd);
+            }
+            // The pipeline keeps running shell code, it must not hold the other workers' pipes open
+            closeInheritedFds();
+            return runPipeline(getPipeline(worker.data.pline));
+        });
+
+        childPids.push_back(childPid);
+        closeFile(readFd);
+        if(outputFd >= 0){
+            closeFile(outputFd);
+        }
+        workerFds.push_back(writeFd);
+    }
+
+    auto merger = startMerger(outputs);
+    ShardDistributor distributor(spec, workerFds);
+    vector<char> chunk(REPEATER_CHUNK_SIZE);
+    auto sent = true;
+
+    while(sent){
+        auto count = processes->read(STDIN_FILENO, chunk.data(), chunk.size());
+        if(count < 0 && errno == EINTR){
+            continue;
+        }
+        assert(count >= 0, "sharder-read");
+        if(count == 0){
+            sent = distributor.finish();
+            break;
+        }
+
+        sent = distributor.feed(chunk.data(), count);
+    }
+
+    if(!sent){
+        fprintf(stderr, "Write failed: %s\n", strerror(errno));
+        assert(false, "pipe-write");
+    }
+
+    for(auto fd : workerFds){
+        closeFile(fd);
+    }
+
+    int result = 0;
+    for(auto childPid : childPids){
+        auto status = waitForChildProcess(childPid);
+        if(result == 0){
+            result = status;
+        }
+    }
+    finishMerger(merger);
+
+    return result;
+}
+
+// Label for a pipeline stage in reports
+string stageName(const CommandSubshellArgs& command){
+    if(command.isCommand){
+        return command.commandArgs.args[0];
+    }
+
+    if(command.isShard){
+        return string("[") + command.subshellArgs.str + "]";
+    }
+
+    return string("(") + command.subshellArgs.str + ")";
+}
+
+// We alreayd know we're in the pipeline here
+// Returns the status of the last stage
+int runPipeline(const PipelineArgs& input)
+{
+    // cout << "RunPipelineStarted" << endl;
+
+    vector<pid_t> childPids;
+    auto inputCount = (int)input.count;
+
+    int pipeCount = inputCount - 1;
+    int* pipeWriteFds = new int[pipeCount];
+    int* pipeReadFds = new int[pipeCount];
+
+    // Metering: stage i writes into relayReadFds[i], the relay forwards it to relayWriteFds[i] for stage i + 1
+    vector<int> relayReadFds(pipeCount), relayWriteFds(pipeCount);
+
+    // Example: A | B | C
+    // F1: OG/A, F2: OG/B, F3: OG/C (Requires 3 fork)
+    // P1: A->B, P2: B->C (Requires 2 pipe)
+    for (int i = 0; i < inputCount; i++)
+    {
+        auto currentCommand = input.commands[i];
+        if(currentCommand.isCommand){
+            expandCommand(*currentCommand.commandArgs.cmd);
+            currentCommand.commandArgs.args = argumentsOf(*currentCommand.commandArgs.cmd);
+        }
+  
+        if(i != inputCount - 1){
+            // cout << "Create pipe at index" << i << endl;
+            pipe(pipeReadFds[i], pipeWriteFds[i]);
+
+            if(options.meter){
+                relayReadFds[i] = pipeReadFds[i];
+                pipe(pipeReadFds[i], relayWriteFds[i]);
+            }
+        }
+
+        auto childPid = startChild("pipeline stage", [=]() -> int{
+            // Redirect A -> B, B -> C, Run A, B, C
+
+            if(i != 0){
+                // B listens from A
+                // C listens from B
+                redirectStdin(pipeReadFds[i - 1]);
+            }
+
+            // A writes to B
+            // B writes to C
+            if(i != inputCount - 1){
+                redirectStdout(pipeWriteFds[i]);
+            }
+
+            // Every other pipe end (and relay end) is close-on-exec. A subshell stage keeps running
+            // as a shell, it has to drop them itself or its readers never see EOF.
+            if(!currentCommand.isCommand){
+                closeInheritedFds();
+            }
+
+            if(currentCommand.isCommand){
+                if(currentCommand.commandArgs.inputFile != NULL){
+                    redirectInputFile(currentCommand.commandArgs.inputFile);
+                }
+                // Notice program a doesn't continue after here
+                runCommand(currentCommand.commandArgs.args);
+                return 0;
+            }
+
+            // With --fan-in, a group's branches don't share the pipe to the next stage
+            auto mergeOutput = options.fanIn && i != inputCount - 1;
+            char str[INPUT_BUFFER_SIZE];
+            strcpy(str, currentCommand.subshellArgs.str);
+            if(currentCommand.isShard){
+                ShardSpec spec;
+                auto commands = parseShardSpec(str, spec);
+                if(commands == NULL){
+                    cerr << "Unknown shard policy, expected rr:, least:, hash: or hash=N:" << endl;
+                }
+                assert(commands != NULL, "shard-policy");
+                auto input = parseInput(commands);
+                auto isParallel = input->num_inputs > 1 && input->separator == SEPARATOR_PARA;
+
+                // A single worker gets every line anyway
+                return isParallel ? runSharder(input, spec, mergeOutput) : runForInput(input);
+            }
+
+            auto input = parseInput(str);
+            auto isParallel = input->num_inputs > 1 && input->separator == SEPARATOR_PARA;
+            return isParallel ? runRepeater(input, mergeOutput, i != 0) : runForInput(input);
+        });
+
+        // OG Process
+        childPids.push_back(childPid);
+
+        // The ends this stage got are its own now. Holding the write end would hide EOF from the next
+        // stage, holding the read end would keep the previous stage from getting SIGPIPE.
+        if(i != 0){
+            closeFile(pipeReadFds[i - 1]);
+        }
+        if(i != inputCount - 1){
+            closeFile(pipeWriteFds[i]);
+        }
+    }
+
+    vector<PipeRelay*> relays;
+    // What SIGPIPE did before, put back afterwards: a program running lines through embed.h has its own
+    struct sigaction previousPipe;
+    if(options.meter){
+        // A relay writing to a stage that already exited must get EPIPE, not kill the shell
+        struct sigaction ignore;
+        memset(&ignore, 0, sizeof(ignore));
+        ignore.sa_handler = SIG_IGN;
+        sigemptyset(&ignore.sa_mask);
+        sigaction(SIGPIPE, &ignore, &previousPipe);
+
+        for(int i = 0; i < pipeCount; i++){
+            // The relay closes them when it's done
+            shellFds.forget(relayReadFds[i]);
+            shellFds.forget(relayWriteFds[i]);
+            relays.push_back(new PipeRelay(relayReadFds[i], relayWriteFds[i],
+                                           stageName(input.commands[i]), stageName(input.commands[i + 1])));
+            relays.back()->start();
+        }
+    }
+
+    int result = 0;
+    auto childCount = (int)childPids.size();
+    for(int i = 0; i < childCount; i++){
+        // cout << "Waiting for child..." << childPids[i] << endl;
+        result = waitForChildProcess(childPids[i]);
+        // cout << "One child process exited: " << childPids[i] << endl;
+    }
+
+    if(options.meter){
+        vector<PipeMeterStats> stats;
+        for(auto relay : relays){
+            relay->join();
+            stats.push_back(relay->stats());
+            delete relay;
+        }
+        sigaction(SIGPIPE, &previousPipe, NULL);
+        printMeterReport(stats);
+    }
+
+    delete[] pipeWriteFds;
+    delete[] pipeReadFds;
+
+    // cout << "Pipeline run done!" << endl;     
+    return result;
+}
+
+// Returns the status of the first branch that failed, 0 if none did.
+// With fail-fast, the branches share a process group so a failure can stop the others' whole trees. On a
+// terminal that group is in the foreground while the branches run.
+// With a memory budget (see budget.h), a branch is held back while the group is over the budget.
+// Only the branches are waited for, never another child of the process (a program embedding the library
+// has its own).
+int runParallel(parsed_input* input){
+    auto inputCount = (int)input->num_inputs;
+    assert(inputCount > 1, "numinputs");
+
+    auto budget = options.memoryBudget > 0 ? new MemoryBudget(options.memoryBudget, inputCount) : NULL;
+    auto ownGroups = options.failFast;
+    // Only the terminal's foreground group may read it, the branches' group would be stopped by SIGTTIN
+    // without it
+    auto onTerminal = ownGroups && isatty(STDIN_FILENO);
+    pid_t sharedGroup = 0;
+    pid_t previousForeground = -1;
+    vector<pid_t> childPids(inputCount, -1);
+    vector<bool> running(inputCount, false);
+    int runningCount = 0;
+    int result = 0;
+    bool killed = false;
+
+    // Reaps one branch, or without block one that's already done if there is one. Returns the pid reaped, 0
+    // if none was and -1 if there was nothing to wait for.
+    auto reapBranch = [&](bool block) -> pid_t{
+        if(runningCount == 0){
+            return -1;
+        }
+
+        int status;
+        long long peakKilobytes;
+        pid_t pid = 0;
+        if(!block){
+            for(int j = 0; j < inputCount && pid == 0; j++){
+                if(running[j]){
+                    pid = processes->waitMeasured(childPids[j], status, peakKilobytes, false);
+                }
+            }
+        } else if(ownGroups){
+            // Every running branch is in sharedGroup (a new one is only made once the old one is empty), so
+            // the first to end is the one reaped and a failure is seen right away
+            pid = processes->waitMeasured(-sharedGroup, status, peakKilobytes, true);
+        } else{
+            // Nothing is stopped early, so the order branches are reaped in doesn't matter
+            auto first = 0;
+            while(!running[first]){
+                first++;
+            }
+            pid = processes->waitMeasured(childPids[first], status, peakKilobytes, true);
+        }
+        if(pid < 0 && errno == EINTR){
+            return 0;
+        }
+        if(pid < 0){
+            fprintf(stderr, "waitpid failed: %s\n", strerror(errno));
+            if(result == 0){
+                result = 255;
+            }
+            return -1;
+        }
+        if(pid == 0){
+            return 0;
+        }
+        forgetChild(pid);
+
+        int index = 0;
+        while(index < inputCount && childPids[index] != pid){
+            index++;
+        }
+        if(index == inputCount){
+            return pid;
+        }
+
+        running[index] = false;
+        runningCount--;
+        if(budget != NULL){
+            budget->finished(index, peakKilobytes);
+        }
+        auto exitCode = exitStatus(status);
+        if(exitCode == 0 || killed){
+            return pid;
+        }
+
+        if(result == 0){
+            result = exitCode;
+        }
+
+        if(options.failFast){
+            killed = true;
+            if(runningCount > 0){
+                processes->killGroup(sharedGroup, SIGTERM);
+            }
+        }
+        return pid;
+    };
+
+    // After a fail-fast kill, the branches not started yet never are
+    for(int i = 0; i < inputCount && !killed; i++){
+        // Usage also drops without a branch ending, so it's looked at again every moment
+        while(budget != NULL && !killed && !budget->admit(i, runningCount)){
+            auto reaped = reapBranch(false);
+            if(reaped < 0){
+                break;
+            }
+            if(reaped == 0){
+                budget->pause();
+            }
+        }
+        if(killed){
+            break;
+        }
+
+        auto& branch = input->inputs[i];
+        if(branch.type == INPUT_TYPE_COMMAND){
+            expandCommand(branch.data.cmd);
+        }
+        auto joinGroup = sharedGroup;
+        auto childPid = startChild("parallel branch", [&branch, ownGroups, joinGroup, budget, i]() -> int{
+            // With every earlier branch gone, so is their group, the parent then makes this one lead a new one
+            if(ownGroups && !processes->setProcessGroup(0, joinGroup)){
+                processes->setProcessGroup(0);
+            }
+            if(budget != NULL){
+                budget->enter(i);
+            }
+
+            auto type = branch.type;
+            if(type == INPUT_TYPE_COMMAND){
+                runCommand(branch.data.cmd);
+            } else if(type == INPUT_TYPE_PIPELINE){
+                return runPipeline(getPipeline(branch.data.pline));
+            } else if(type == INPUT_TYPE_SUBSHELL){
+                // The branch's process is the subshell, its contents run right here
+                return runForInput(parseInput(branch.data.subshell));
+            } else{
+                assert(false, "inputtype-runpara");
+            }
+            return 0;
+        });
+
+        // Also done here so a kill can't race the child's own setpgid
+        if(ownGroups && (joinGroup == 0 || !processes->setProcessGroup(childPid, joinGroup))){
+            processes->setProcessGroup(childPid);
+            sharedGroup = childPid;
+            if(onTerminal){
+                auto previous = processes->setForeground(sharedGroup);
+                if(previousForeground < 0){
+                    previousForeground = previous;
+                }
+            }
+        }
+        childPids[i] = childPid;
+        running[i] = true;
+        runningCount++;
+        if(budget != NULL){
+            budget->started(i, childPid);
+        }
+    }
+
+    while(runningCount > 0 && reapBranch(true) >= 0){
+    }
+    if(previousForeground >= 0){
+        processes->setForeground(previousForeground);
+    }
+
+    if(budget != NULL){
+        vector<string> names;
+        for(int i = 0; i < inputCount; i++){
+            names.push_back(describeInput(input->inputs[i]));
+        }
+        budget->report(names);
+        delete budget;
+    }
+
+    // cout << "Parallel Run Done." << endl;
+    return result;
+}
+
+// Returns the status of the last input that ran.
+// An input after && only runs if the last status was 0, one after || only if it wasn't.
+int runSequential(parsed_input* input){
+    // Example: A ; B ; C
+    // Forking: OG/A, OG/B, OG/C (3 times)
+    auto inputCount = (int)input->num_inputs;
+    assert(inputCount > 1, "numinputs");
+
+    // cout << "Sequential Run started." << endl;
+
+    int result = 0;
+    for(int i = 0; i < inputCount; i++){
+        auto link = input->links[i];
+        if(i > 0 && link == SEPARATOR_AND && result != 0){
+            continue;
+        }
+        if(i > 0 && link == SEPARATOR_OR && result == 0){
+            continue;
+        }
+        if(i > 0 && link == SEPARATOR_SEQ && result != 0 && options.failFast){
+            break;
+        }
+
+        auto& step = input->inputs[i];
+        if(step.type == INPUT_TYPE_COMMAND){
+            expandCommand(step.data.cmd);
+        }
+        auto childPid = startChild("sequence step", [&step]() -> int{
+            auto type = step.type;
+            if(type == INPUT_TYPE_COMMAND){
+                runCommand(step.data.cmd);
+            } else if(type == INPUT_TYPE_PIPELINE){
+                // Notice: It runs the pipeline as the main program, its status is the child's
+                return runPipeline(getPipeline(step.data.pline));
+            } else if(type == INPUT_TYPE_SUBSHELL){
+                return runForInput(parseInput(step.data.subshell));
+            } else{
+                assert(false, "inputtype-seq");
+            }
+            return 0;
+        });
+
+        result = waitForChildProcess(childPid);
+    }
+
+    // cout << "Sequential Run Done!" << endl;
+    return result;
+}
+
+int runSingleSubshell(char* str){
+    auto childPid = startChild("subshell", [str]{
+        return runForInput(parseInput(str));
+    });
+    return waitForChildProcess(childPid);
+}
+
+int runSingleCommand(parsed_input* input){
+    auto type = input->inputs[0].type;
+    assert(type == INPUT_TYPE_COMMAND, "inputtype-singlecommand");
+
+    auto& cmd = input->inputs[0].data.cmd;
+    expandCommand(cmd);
+    auto childPid = startChild("command", [&cmd]() -> int{
+        // Child process inherits the stdout from parent, no need for redirection
+        runCommand(cmd);
+        return 0;
+    });
+    return waitForChildProcess(childPid);
+}
+
+int runNoSeparator(parsed_input* input){
+    auto type = input->inputs[0].type;
+    if(type == INPUT_TYPE_COMMAND){
+        return runSingleCommand(input);
+    } else if(type == INPUT_TYPE_SUBSHELL){
+        auto& subshell = input->inputs[0].data.subshell;
+        return runSingleSubshell(subshell);
+        // runForInput(parseInput(subshell));
+    } else{
+        assert(false, "unexpected input no separator");
+    }
+
+    return 0;
+}
+
+// Runs the parsed line and returns its exit status
+int runForInput(parsed_input* ptr){
+    // pretty_print(ptr);
+    auto separator = ptr->separator;
+    int status = 0;
+
+    switch (separator)
+    {
+    case SEPARATOR_PARA:
+    {
+        status = runParallel(ptr);
+        break;
+    }
+    case SEPARATOR_PIPE:
+    {
+        status = runPipeline(getPipeline(ptr));
+        break;
+    }
+    case SEPARATOR_SEQ:
+    {
+        status = runSequential(ptr);
+        break;
+    }
+    case SEPARATOR_NONE:
+    {
+        status = runNoSeparator(ptr);
+        break;
+    }
+    default:
+        {
+            assert(false, "unexpected separator");
+        }
+    }
+
+    free_parsed_input(ptr);
+    delete ptr;
+    return status;
+}
+
+void abandonLine(){
+    // Whatever still holds the other ends sees EOF or EPIPE and finishes
+    shellFds.closeAll();
+    while(!unreapedChildren.empty()){
+        waitForChildProcess(unreapedChildren.front());
+    }
+}
+
+int runLine(parsed_input* input){
+    lineStarted();
+    if(options.optimize){
+        vector<string> rewrites;
+        optimizeLine(input, rewrites);
+        if(options.optimizeReport){
+            for(auto& rewrite : rewrites){
+                cerr << "optimize: " << rewrite << endl;
+            }
+        }
+    }
+    auto status = runForInput(input);
+    lineFinished();
+    return status;
+}
+
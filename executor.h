@@ -0,0 +1,64 @@
+#ifndef EXECUTOR_H
+#define EXECUTOR_H
+
+#include <string>
+#include "parser.h"
+#include "fanout.h"
+#include "process.h"
+
+// Runs parsed lines: forks, pipes and waits through the process backend (see process.h)
+
+struct ShellOptions {
+    // Stop a sequence at the first failure and kill the rest of a parallel group when a branch fails
+    bool failFast;
+    // Relay every pipeline pipe through the shell and report per-stage throughput and backpressure
+    bool meter;
+    // How the repeater writes to its consumers
+    FanOutBackend repeaterIo;
+    // Spool the repeater's input once and let each consumer read it at its own pace instead (see spool.h)
+    bool repeaterSpool;
+    // Merge the outputs of a group's branches into the next pipeline stage whole lines at a time, each
+    // line tagged with its branch if asked to (see fanin.h)
+    bool fanIn;
+    bool fanInTag;
+    // --memory-budget: bytes the branches of a parallel group may use together, 0 for no budget (see budget.h)
+    long long memoryBudget;
+    // Simplify each line before running it (see optimizer.h), and say which rewrites fired
+    bool optimize;
+    bool optimizeReport;
+    // Set while explain runs a line on the simulated backend: $(...) would run real commands, so nothing
+    // is expanded
+    bool explainOnly;
+    // --daemon: serve lines on this Unix socket instead of reading them
+    const char* daemonSocket;
+    // --client: send clientLine to the daemon on this socket and exit with its status
+    const char* clientSocket;
+    std::string clientLine;
+    // Script mode: how many lines the front end parses ahead (0 for the default), and whether it warms the
+    // page cache for their programs meanwhile (see readahead.h)
+    size_t lookahead;
+    bool readahead;
+    // --journal: checkpoint script lines here and resume after the ones that already succeeded (see journal.h)
+    const char* journalPath;
+    bool journalRecheck;
+};
+
+
+extern ShellOptions options;
+
+// Throws a ShellError with the message if the condition doesn't hold
+void assert(bool condition, std::string message);
+
+// Parses a line that is about to run, a parse error is a ShellError
+parsed_input* parseInput(char* str);
+
+// Runs the parsed line and returns its exit status. Frees the line.
+int runForInput(parsed_input* ptr);
+
+// runForInput for a line the shell read: brackets it for the diagnostics and optimizes it if asked to
+int runLine(parsed_input* input);
+
+// After a ShellError unwound out of a line: closes the pipes it left open and reaps the children it started
+void abandonLine();
+
+#endif //EXECUTOR_H
@@ -0,0 +1,174 @@
+#include "expansion.h"
+#include "wildcard.h"
+#include <ctype.h>
+#include <stdlib.h>
+#include <string.h>
+
+using namespace std;
+
+namespace {
+
+// A piece of an argument: literal text, or the command inside a $(...)
+struct ArgumentPart {
+    bool isCommand;
+    string text;
+};
+
+// Splits an argument at each $(...), matching parentheses and skipping quotes the way the parser did
+vector<ArgumentPart> splitArgument(const string& arg){
+    vector<ArgumentPart> parts;
+    string literal;
+
+    for(size_t i = 0; i < arg.size();){
+        if(arg[i] != '$' || i + 1 == arg.size() || arg[i + 1] != '('){
+            literal += arg[i++];
+            continue;
+        }
+
+        size_t end = i + 1;
+        int depth = 0;
+        char quote = 0;
+        for(; end < arg.size(); end++){
+            if(quote){
+                if(arg[end] == quote){
+                    quote = 0;
+                }
+            } else if(arg[end] == '"' || arg[end] == '\''){
+                quote = arg[end];
+            } else if(arg[end] == '('){
+                depth++;
+            } else if(arg[end] == ')' && --depth == 0){
+                break;
+            }
+        }
+        // Unbalanced, which the parser doesn't let through, the rest is plain text
+        if(end == arg.size()){
+            literal += arg.substr(i);
+            break;
+        }
+
+        if(!literal.empty()){
+            parts.push_back({false, literal});
+            literal.clear();
+        }
+        parts.push_back({true, arg.substr(i + 2, end - i - 2)});
+        i = end + 1;
+    }
+
+    if(!literal.empty()){
+        parts.push_back({false, literal});
+    }
+    return parts;
+}
+
+bool needsExpansion(const command& cmd){
+    if(cmd.argv != NULL){
+        return false;
+    }
+    for(int i = 0; i < MAX_ARGS && cmd.args[i] != NULL; i++){
+        auto bit = 1u << i;
+        if((cmd.substituted & bit) || (!(cmd.quoted & bit) && hasWildcard(cmd.args[i]))){
+            return true;
+        }
+    }
+    return false;
+}
+
+// Appends the words args[i] expands to, taking substitution outputs from outputs[nextOutput...]
+void expandArgument(const command& cmd, int i, const vector<string>& outputs, size_t& nextOutput, vector<string>& words){
+    string arg = cmd.args[i];
+    auto quoted = (cmd.quoted & (1u << i)) != 0;
+
+    if(!(cmd.substituted & (1u << i))){
+        if(!quoted && hasWildcard(arg)){
+            auto matches = matchWildcard(arg);
+            if(!matches.empty()){
+                words.insert(words.end(), matches.begin(), matches.end());
+                return;
+            }
+        }
+        words.push_back(arg);
+        return;
+    }
+
+    string current;
+    auto inWord = false;
+    for(auto& part : splitArgument(arg)){
+        if(!part.isCommand){
+            current += part.text;
+            inWord = true;
+            continue;
+        }
+
+        auto output = outputs[nextOutput++];
+        while(!output.empty() && output[output.size() - 1] == '\n'){
+            output.erase(output.size() - 1);
+        }
+
+        if(quoted){
+            current += output;
+            inWord = true;
+            continue;
+        }
+        for(auto c : output){
+            if(isspace((unsigned char)c)){
+                if(inWord){
+                    words.push_back(current);
+                    current.clear();
+                    inWord = false;
+                }
+            } else{
+                current += c;
+                inWord = true;
+            }
+        }
+    }
+
+    // "$(true)" is still an (empty) argument, an unquoted empty substitution is none
+    if(inWord || quoted){
+        words.push_back(current);
+    }
+}
+
+}
+
+void expandCommand(command& cmd, SubstitutionRunner runSubstitutions){
+    if(!needsExpansion(cmd)){
+        return;
+    }
+
+    // The command's substitutions are handed over at once so they can run side by side
+    vector<string> substitutions;
+    for(int i = 0; i < MAX_ARGS && cmd.args[i] != NULL; i++){
+        if(cmd.substituted & (1u << i)){
+            for(auto& part : splitArgument(cmd.args[i])){
+                if(part.isCommand){
+                    substitutions.push_back(part.text);
+                }
+            }
+        }
+    }
+
+    vector<string> outputs;
+    if(!substitutions.empty()){
+        outputs = runSubstitutions(substitutions);
+    }
+
+    size_t nextOutput = 0;
+    vector<string> words;
+    for(int i = 0; i < MAX_ARGS && cmd.args[i] != NULL; i++){
+        expandArgument(cmd, i, outputs, nextOutput, words);
+    }
+    // Nothing left to run, keep the command name so the error names what was written
+    if(words.empty()){
+        words.push_back(cmd.args[0]);
+    }
+
+    // Plain malloc, free_command releases it
+    auto argv = (char**)malloc((words.size() + 1) * sizeof(char*));
+    for(size_t i = 0; i < words.size(); i++){
+        argv[i] = strdup(words[i].c_str());
+    }
+    argv[words.size()] = NULL;
+    cmd.argv = argv;
+}
@@ -0,0 +1,21 @@
+#ifndef EXPANSION_H
+#define EXPANSION_H
+
+#include <string>
+#include <vector>
+#include "parser.h"
+
+// Runs the commands of every $(...) in one command's arguments, all at once, and returns what each wrote to
+// stdout. The executor provides it, this module only decides what gets run and where the output goes.
+typedef std::vector<std::string> (*SubstitutionRunner)(const std::vector<std::string>& commands);
+
+// Expands the arguments of a command right before it starts, so they see what the line's earlier steps did
+// and a command that doesn't run has nothing of its run either:
+//  - $(...) is replaced by the command's output without trailing newlines. Outside quotes the output is
+//    split on whitespace into separate arguments, inside double quotes it stays one argument.
+//  - Unquoted arguments with *, ? or [...] become the matching paths, or stay as they are if nothing matches.
+// A command that had anything expanded gets its own argv (see command.argv), one that has one already is
+// left alone.
+void expandCommand(command& cmd, SubstitutionRunner runSubstitutions);
+
+#endif //EXPANSION_H
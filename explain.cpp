@@ -0,0 +1,132 @@
+#include "explain.h"
+#include "executor.h"
+#include "optimizer.h"
+#include "simprocess.h"
+#include <algorithm>
+#include <iostream>
+#include <map>
+#include <stdio.h>
+
+using namespace std;
+
+namespace {
+
+typedef SimulatedProcesses::TraceEntry TraceEntry;
+
+// The simulated shell the line runs in
+const pid_t SHELL_PID = 1;
+
+string jsonString(const string& text){
+    string quoted = "\"";
+    for(auto c : text){
+        if(c == '"' || c == '\\'){
+            quoted += '\\';
+            quoted += c;
+        } else if((unsigned char)c < 0x20){
+            char escape[8];
+            snprintf(escape, sizeof(escape), "\\u%04x", c);
+            quoted += escape;
+        } else{
+            quoted += c;
+        }
+    }
+    return quoted + "\"";
+}
+
+void printTree(const map<pid_t, vector<const TraceEntry*>>& children, pid_t parent, int depth){
+    auto it = children.find(parent);
+    if(it == children.end()){
+        return;
+    }
+    for(auto entry : it->second){
+        cout << string(depth * 2, ' ') << "[" << entry->role << "] "
+             << (entry->command.empty() ? "shell" : entry->command)
+             << "  stdin=" << entry->input << " stdout=" << entry->output << endl;
+        printTree(children, entry->pid, depth + 1);
+    }
+}
+
+void printText(const vector<TraceEntry>& trace, int shells, long long pipes, const vector<string>& rewrites,
+               const vector<string>& problems){
+    for(auto& rewrite : rewrites){
+        cout << "optimize: " << rewrite << endl;
+    }
+
+    map<pid_t, vector<const TraceEntry*>> children;
+    for(auto& entry : trace){
+        children[entry.parent].push_back(&entry);
+    }
+    cout << "shell" << endl;
+    printTree(children, SHELL_PID, 1);
+
+    cout << trace.size() << " fork" << (trace.size() == 1 ? "" : "s") << " (" << shells << " intermediate shell"
+         << (shells == 1 ? "" : "s") << "), " << pipes << " pipe" << (pipes == 1 ? "" : "s") << endl;
+    for(auto& problem : problems){
+        cout << "warning: " << problem << endl;
+    }
+}
+
+void printJson(const vector<TraceEntry>& trace, int shells, long long pipes, const vector<string>& rewrites,
+               const vector<string>& problems){
+    cout << "{\"forks\":" << trace.size() << ",\"shells\":" << shells << ",\"pipes\":" << pipes << ",\"processes\":[";
+    for(size_t i = 0; i < trace.size(); i++){
+        auto& entry = trace[i];
+        cout << (i == 0 ? "" : ",") << "{\"pid\":" << entry.pid << ",\"parent\":" << entry.parent
+             << ",\"role\":" << jsonString(entry.role) << ",\"command\":"
+             << (entry.command.empty() ? "null" : jsonString(entry.command))
+             << ",\"stdin\":" << jsonString(entry.input) << ",\"stdout\":" << jsonString(entry.output) << "}";
+    }
+    cout << "],\"rewrites\":[";
+    for(size_t i = 0; i < rewrites.size(); i++){
+        cout << (i == 0 ? "" : ",") << jsonString(rewrites[i]);
+    }
+    cout << "],\"warnings\":[";
+    for(size_t i = 0; i < problems.size(); i++){
+        cout << (i == 0 ? "" : ",") << jsonString(problems[i]);
+    }
+    cout << "]}" << endl;
+}
+
+}
+
+void explainLine(parsed_input* input, bool json){
+    vector<string> rewrites;
+    if(options.optimize){
+        optimizeLine(input, rewrites);
+    }
+
+    // Relays, mergers and spool feeders are threads doing real IO, they can't work on simulated fds, and a
+    // memory budget would make real cgroups for simulated processes
+    auto saved = options;
+    options.meter = false;
+    options.fanIn = false;
+    options.repeaterSpool = false;
+    options.memoryBudget = 0;
+    options.explainOnly = true;
+
+    SimulatedProcesses simulated;
+    simulated.setTracing(true);
+    auto previous = processes;
+    processes = &simulated;
+    runForInput(input);
+    simulated.finishLine();
+    processes = previous;
+    options = saved;
+
+    // Sorted by pid, which is the order they were started in
+    auto trace = simulated.trace();
+    sort(trace.begin(), trace.end(), [](const TraceEntry& a, const TraceEntry& b){ return a.pid < b.pid; });
+
+    auto shells = 0;
+    for(auto& entry : trace){
+        if(entry.command.empty()){
+            shells++;
+        }
+    }
+
+    if(json){
+        printJson(trace, shells, simulated.stats().pipes, rewrites, simulated.problems());
+    } else{
+        printText(trace, shells, simulated.stats().pipes, rewrites, simulated.problems());
+    }
+}
@@ -0,0 +1,17 @@
+#ifndef EXPLAIN_H
+#define EXPLAIN_H
+
+#include "parser.h"
+
+// The explain builtin: runs the line on the simulated process backend (see simprocess.h), so nothing is
+// spawned, and prints every process the executor would start, what it is for, how its stdin and stdout
+// are wired, and how many forks and pipes that takes. Shells that never exec (sequence steps running a
+// pipeline, subshells, repeaters...) are the processes a rewrite of the line could save.
+//
+// The plan is the one for every command succeeding ("false" fails), so a step after || shows as not
+// started. $(...) and wildcards are left unexpanded, and --meter relays and --fan-in mergers are left out.
+// With --optimize the line is optimized first, as it would be before running.
+// Frees the line.
+void explainLine(parsed_input* input, bool json);
+
+#endif //EXPLAIN_H
@@ -0,0 +1,179 @@
+#include "fanin.h"
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include <poll.h>
+#ifdef __linux__
+#include <sys/epoll.h>
+#endif
+
+using namespace std;
+
+namespace {
+
+// Read from one source per readiness event
+const size_t FANIN_READ_SIZE = 64 * 1024;
+// Forward early once this much is collected, otherwise once per round of readiness events
+const size_t FANIN_BATCH_SIZE = 256 * 1024;
+
+}
+
+FanInMerger::FanInMerger(const vector<int>& fds, const vector<string>& tags, int out) : out(out){
+    for(size_t i = 0; i < fds.size(); i++){
+        sources.push_back({fds[i], i < tags.size() ? "[" + tags[i] + "] " : "", ""});
+    }
+}
+
+void FanInMerger::start(){
+    thread = std::thread(&FanInMerger::run, this);
+}
+
+void FanInMerger::join(){
+    thread.join();
+}
+
+void FanInMerger::takeLines(Source& source, const char* data, size_t size){
+    const char* end = data + size;
+
+    // Untagged, everything up to the last newline moves over in one piece
+    if(source.prefix.empty()){
+        auto lineEnd = end;
+        while(lineEnd > data && lineEnd[-1] != '\n'){
+            lineEnd--;
+        }
+        if(lineEnd > data){
+            batch += source.partial;
+            source.partial.clear();
+            batch.append(data, lineEnd - data);
+            data = lineEnd;
+        }
+        source.partial.append(data, end - data);
+        return;
+    }
+
+    while(data < end){
+        auto newline = (const char*)memchr(data, '\n', end - data);
+        if(newline == NULL){
+            source.partial.append(data, end - data);
+            return;
+        }
+
+        batch += source.prefix;
+        if(!source.partial.empty()){
+            batch += source.partial;
+            source.partial.clear();
+        }
+        batch.append(data, newline + 1 - data);
+        data = newline + 1;
+    }
+}
+
+bool FanInMerger::readSource(Source& source){
+    char buffer[FANIN_READ_SIZE];
+    ssize_t count;
+    do{
+        count = read(source.fd, buffer, sizeof(buffer));
+    } while(count < 0 && errno == EINTR);
+
+    if(count > 0){
+        takeLines(source, buffer, count);
+        if(batch.size() >= FANIN_BATCH_SIZE){
+            flush();
+        }
+        return true;
+    }
+
+    if(!source.partial.empty()){
+        takeLines(source, "\n", 1);
+    }
+    close(source.fd);
+    source.fd = -1;
+    return false;
+}
+
+void FanInMerger::flush(){
+    size_t done = 0;
+    while(!outputGone && done < batch.size()){
+        auto count = write(out, batch.data() + done, batch.size() - done);
+        if(count < 0 && errno == EINTR){
+            continue;
+        }
+        if(count < 0){
+            // The next stage is gone, run() closes the sources so the producers get EPIPE in turn
+            outputGone = true;
+            break;
+        }
+        writeCount++;
+        byteCount += count;
+        done += count;
+    }
+    batch.clear();
+}
+
+void FanInMerger::run(){
+    auto open = sources.size();
+
+#ifdef __linux__
+    auto epollFd = epoll_create1(EPOLL_CLOEXEC);
+    if(epollFd >= 0){
+        for(size_t i = 0; i < sources.size(); i++){
+            struct epoll_event event;
+            event.events = EPOLLIN;
+            event.data.u64 = i;
+            epoll_ctl(epollFd, EPOLL_CTL_ADD, sources[i].fd, &event);
+        }
+
+        struct epoll_event events[64];
+        while(open > 0 && !outputGone){
+            auto ready = epoll_wait(epollFd, events, 64, -1);
+            if(ready < 0 && errno == EINTR){
+                continue;
+            }
+            if(ready < 0){
+                break;
+            }
+            for(int i = 0; i < ready; i++){
+                auto& source = sources[events[i].data.u64];
+                if(source.fd >= 0 && !readSource(source)){
+                    open--;
+                }
+            }
+            flush();
+        }
+        close(epollFd);
+        closeSources();
+        return;
+    }
+#endif
+
+    vector<struct pollfd> fds;
+    for(auto& source : sources){
+        fds.push_back({source.fd, POLLIN, 0});
+    }
+    while(open > 0 && !outputGone){
+        if(poll(fds.data(), fds.size(), -1) < 0){
+            if(errno == EINTR){
+                continue;
+            }
+            break;
+        }
+        for(size_t i = 0; i < fds.size(); i++){
+            if(fds[i].revents != 0 && sources[i].fd >= 0 && !readSource(sources[i])){
+                // poll skips negative fds
+                fds[i].fd = -1;
+                open--;
+            }
+        }
+        flush();
+    }
+    closeSources();
+}
+
+void FanInMerger::closeSources(){
+    for(auto& source : sources){
+        if(source.fd >= 0){
+            close(source.fd);
+            source.fd = -1;
+        }
+    }
+}
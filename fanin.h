@@ -0,0 +1,49 @@
+#ifndef FANIN_H
+#define FANIN_H
+
+#include <string>
+#include <vector>
+#include <thread>
+
+// Merges what several producers write into one fd without ever splitting a line: each source is read
+// through epoll (poll where there is none), complete lines are collected across sources and forwarded in
+// large batched writes. An unterminated last line of a source is forwarded with a newline when it ends.
+// Owns the sources and closes each at its EOF, or all of them once the output's reader is gone, so their
+// producers stop as well; the output fd stays open.
+class FanInMerger {
+public:
+    // With tags, every line of source i is prefixed with "[tags[i]] "
+    FanInMerger(const std::vector<int>& sources, const std::vector<std::string>& tags, int out);
+
+    void start();
+    void join();
+
+    // Write calls made and bytes forwarded
+    long long writes() const { return writeCount; }
+    long long bytes() const { return byteCount; }
+
+private:
+    struct Source {
+        int fd;
+        std::string prefix;
+        // The part of a line that hasn't ended yet
+        std::string partial;
+    };
+
+    void run();
+    // Reads what's there, false at EOF or on an error
+    bool readSource(Source& source);
+    void takeLines(Source& source, const char* data, size_t size);
+    void flush();
+    void closeSources();
+
+    std::vector<Source> sources;
+    int out;
+    std::string batch;
+    bool outputGone = false;
+    long long writeCount = 0;
+    long long byteCount = 0;
+    std::thread thread;
+};
+
+#endif //FANIN_H
@@ -0,0 +1,261 @@
+#include "fanout.h"
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+#include <stdint.h>
+
+#if defined(__linux__) && __has_include(<linux/io_uring.h>)
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#define HAVE_IO_URING 1
+#else
+#define HAVE_IO_URING 0
+#endif
+
+using namespace std;
+
+// One consumer after the other, each gets the whole buffer before the next one starts
+class BlockingFanOut : public FanOutWriter {
+public:
+    void broadcast(const char* data, size_t size, const vector<int>& fds, vector<bool>& failed) override {
+        for(size_t i = 0; i < fds.size(); i++){
+            size_t written = 0;
+            while(!failed[i] && written < size){
+                auto result = write(fds[i], data + written, size - written);
+                syscallCount++;
+
+                if(result < 0 && errno == EINTR){
+                    continue;
+                }
+                if(result <= 0){
+                    failed[i] = true;
+                } else{
+                    written += result;
+                }
+            }
+        }
+    }
+
+    const char* name() const override { return "blocking"; }
+};
+
+#if HAVE_IO_URING
+
+// Queues one write per consumer and submits them together, so every consumer's pipe is filled
+// concurrently and a whole round costs a couple of io_uring_enter calls instead of one write each.
+class UringFanOut : public FanOutWriter {
+public:
+    static UringFanOut* open(unsigned entries){
+        auto ring = new UringFanOut();
+        if(!ring->setup(entries)){
+            delete ring;
+            return NULL;
+        }
+        return ring;
+    }
+
+    ~UringFanOut(){
+        if(sqes != NULL){
+            munmap(sqes, sqesSize);
+        }
+        if(cqRing != NULL && cqRing != sqRing){
+            munmap(cqRing, cqRingSize);
+        }
+        if(sqRing != NULL){
+            munmap(sqRing, sqRingSize);
+        }
+        if(ringFd >= 0){
+            close(ringFd);
+        }
+    }
+
+    void broadcast(const char* data, size_t size, const vector<int>& fds, vector<bool>& failed) override {
+        auto count = fds.size();
+        vector<size_t> written(count, 0);
+        vector<bool> inFlight(count, false);
+        size_t pending = 0;
+        unsigned unsubmitted = 0;
+
+        while(true){
+            // Queue the rest of the buffer for every consumer that isn't already being written to
+            unsigned queued = 0;
+            for(size_t i = 0; i < count && pending < sqEntries; i++){
+                if(failed[i] || inFlight[i] || written[i] >= size){
+                    continue;
+                }
+                queueWrite(fds[i], data + written[i], size - written[i], i);
+                inFlight[i] = true;
+                pending++;
+                queued++;
+            }
+
+            if(pending == 0){
+                return;
+            }
+
+            unsubmitted += queued;
+            int result;
+            do{
+                result = (int)syscall(__NR_io_uring_enter, ringFd, unsubmitted, (unsigned)pending, IORING_ENTER_GETEVENTS, NULL, 0);
+                syscallCount++;
+            } while(result < 0 && (errno == EINTR || errno == EAGAIN || errno == EBUSY));
+
+            if(result < 0){
+                // Ring is broken, give up on the writes that were waiting for it
+                for(size_t i = 0; i < count; i++){
+                    failed[i] = failed[i] || inFlight[i];
+                }
+                return;
+            }
+            unsubmitted -= result;
+
+            unsigned head = *cqHead;
+            unsigned tail = __atomic_load_n(cqTail, __ATOMIC_ACQUIRE);
+            for(; head != tail; head++){
+                auto& cqe = cqes[head & *cqMask];
+                auto i = (size_t)cqe.user_data;
+                inFlight[i] = false;
+                pending--;
+
+                if(cqe.res == -EINTR || cqe.res == -EAGAIN){
+                    continue;
+                }
+                if(cqe.res <= 0){
+                    failed[i] = true;
+                } else{
+                    written[i] += cqe.res;
+                }
+            }
+            __atomic_store_n(cqHead, head, __ATOMIC_RELEASE);
+        }
+    }
+
+    const char* name() const override { return "io_uring"; }
+
+private:
+    UringFanOut() {}
+
+    bool setup(unsigned entries){
+        io_uring_params params;
+        memset(&params, 0, sizeof(params));
+
+        ringFd = (int)syscall(__NR_io_uring_setup, entries, &params);
+        if(ringFd < 0){
+            return false;
+        }
+        // Writes at off -1 (pipes have no offset) need both, without them every write fails with EINVAL
+        if(!(params.features & IORING_FEAT_RW_CUR_POS) || !supportsWrite()){
+            return false;
+        }
+
+        sqRingSize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+        cqRingSize = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+        bool singleMmap = params.features & IORING_FEAT_SINGLE_MMAP;
+        if(singleMmap && cqRingSize > sqRingSize){
+            sqRingSize = cqRingSize;
+        }
+
+        sqRing = mmap(NULL, sqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringFd, IORING_OFF_SQ_RING);
+        if(sqRing == MAP_FAILED){
+            sqRing = NULL;
+            return false;
+        }
+
+        if(singleMmap){
+            cqRing = sqRing;
+        } else{
+            cqRing = mmap(NULL, cqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringFd, IORING_OFF_CQ_RING);
+            if(cqRing == MAP_FAILED){
+                cqRing = NULL;
+                return false;
+            }
+        }
+
+        sqesSize = params.sq_entries * sizeof(io_uring_sqe);
+        auto mapped = mmap(NULL, sqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringFd, IORING_OFF_SQES);
+        if(mapped == MAP_FAILED){
+            return false;
+        }
+        sqes = (io_uring_sqe*)mapped;
+
+        auto sq = (char*)sqRing;
+        sqTail = (unsigned*)(sq + params.sq_off.tail);
+        sqMask = (unsigned*)(sq + params.sq_off.ring_mask);
+        sqArray = (unsigned*)(sq + params.sq_off.array);
+        sqEntries = params.sq_entries;
+
+        auto cq = (char*)cqRing;
+        cqHead = (unsigned*)(cq + params.cq_off.head);
+        cqTail = (unsigned*)(cq + params.cq_off.tail);
+        cqMask = (unsigned*)(cq + params.cq_off.ring_mask);
+        cqes = (io_uring_cqe*)(cq + params.cq_off.cqes);
+        return true;
+    }
+
+    bool supportsWrite(){
+#ifdef IO_URING_OP_SUPPORTED
+        // The probe's ops[] follow its header, one per opcode the kernel knows
+        const unsigned opCount = 256;
+        vector<char> buffer(sizeof(io_uring_probe) + opCount * sizeof(io_uring_probe_op), 0);
+        auto probe = (io_uring_probe*)buffer.data();
+        if(syscall(__NR_io_uring_register, ringFd, IORING_REGISTER_PROBE, probe, opCount) < 0){
+            return false;
+        }
+        return IORING_OP_WRITE <= probe->last_op && IORING_OP_WRITE < probe->ops_len &&
+               (probe->ops[IORING_OP_WRITE].flags & IO_URING_OP_SUPPORTED);
+#else
+        return false;
+#endif
+    }
+
+    void queueWrite(int fd, const char* data, size_t size, size_t consumer){
+        unsigned tail = *sqTail;
+        unsigned index = tail & *sqMask;
+        auto& sqe = sqes[index];
+
+        memset(&sqe, 0, sizeof(sqe));
+        sqe.opcode = IORING_OP_WRITE;
+        sqe.fd = fd;
+        sqe.addr = (uint64_t)(uintptr_t)data;
+        sqe.len = size > UINT32_MAX ? UINT32_MAX : (unsigned)size;
+        sqe.off = (uint64_t)-1;  // Pipes have no offset, write at the current position
+        sqe.user_data = consumer;
+
+        sqArray[index] = index;
+        __atomic_store_n(sqTail, tail + 1, __ATOMIC_RELEASE);
+    }
+
+    int ringFd = -1;
+    unsigned sqEntries = 0;
+
+    void* sqRing = NULL;
+    size_t sqRingSize = 0;
+    void* cqRing = NULL;
+    size_t cqRingSize = 0;
+    io_uring_sqe* sqes = NULL;
+    size_t sqesSize = 0;
+
+    unsigned* sqTail = NULL;
+    unsigned* sqMask = NULL;
+    unsigned* sqArray = NULL;
+    unsigned* cqHead = NULL;
+    unsigned* cqTail = NULL;
+    unsigned* cqMask = NULL;
+    io_uring_cqe* cqes = NULL;
+};
+
+#endif
+
+FanOutWriter* createFanOutWriter(FanOutBackend backend){
+#if HAVE_IO_URING
+    if(backend == FanOutBackend::Uring){
+        auto ring = UringFanOut::open(256);
+        if(ring != NULL){
+            return ring;
+        }
+    }
+#endif
+
+    return new BlockingFanOut();
+}
@@ -0,0 +1,31 @@
+#ifndef FANOUT_H
+#define FANOUT_H
+
+#include <vector>
+#include <stddef.h>
+
+enum class FanOutBackend { Auto, Blocking, Uring };
+
+// Writes the same bytes to every consumer pipe of a repeater
+class FanOutWriter {
+public:
+    virtual ~FanOutWriter() {}
+
+    // Writes all of data to each fd whose failed flag is false.
+    // A consumer whose write fails gets its flag set and is skipped from then on.
+    virtual void broadcast(const char* data, size_t size, const std::vector<int>& fds, std::vector<bool>& failed) = 0;
+
+    virtual const char* name() const = 0;
+
+    // Write or io_uring_enter calls made so far
+    long long syscalls() const { return syscallCount; }
+
+protected:
+    long long syscallCount = 0;
+};
+
+// Auto is blocking writes, which bench/fanout_bench measures as fast or faster at 2 to 64 consumers. Uring
+// asks for io_uring and falls back to blocking writes where the kernel can't do plain writes on a ring.
+FanOutWriter* createFanOutWriter(FanOutBackend backend);
+
+#endif //FANOUT_H
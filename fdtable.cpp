@@ -0,0 +1,73 @@
+#include "fdtable.h"
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <sys/mman.h>
+
+FdTable shellFds;
+
+bool FdTable::openPipe(int& readFd, int& writeFd){
+    int fd[2];
+#if defined(__linux__) || defined(__FreeBSD__)
+    if(pipe2(fd, O_CLOEXEC) < 0){
+        return false;
+    }
+#else
+    // No pipe2 (macOS), nothing else forks while we're between the two calls
+    if(pipe(fd) < 0){
+        return false;
+    }
+    fcntl(fd[0], F_SETFD, FD_CLOEXEC);
+    fcntl(fd[1], F_SETFD, FD_CLOEXEC);
+#endif
+
+    readFd = fd[0];
+    writeFd = fd[1];
+    track(readFd);
+    track(writeFd);
+    return true;
+}
+
+int FdTable::openMemoryFile(const char* name){
+#ifdef MFD_CLOEXEC
+    auto fd = memfd_create(name, MFD_CLOEXEC);
+    if(fd >= 0){
+        track(fd);
+    }
+    return fd;
+#else
+    (void)name;
+    errno = ENOSYS;
+    return -1;
+#endif
+}
+
+void FdTable::track(int fd){
+    if((int)isOpen.size() <= fd){
+        isOpen.resize(fd + 1, false);
+    }
+    if(!isOpen[fd]){
+        isOpen[fd] = true;
+        openCount++;
+    }
+}
+
+void FdTable::forget(int fd){
+    if(fd >= 0 && fd < (int)isOpen.size() && isOpen[fd]){
+        isOpen[fd] = false;
+        openCount--;
+    }
+}
+
+int FdTable::close(int fd){
+    forget(fd);
+    return ::close(fd);
+}
+
+void FdTable::closeAll(){
+    for(int fd = 0; fd < (int)isOpen.size() && openCount > 0; fd++){
+        if(isOpen[fd]){
+            close(fd);
+        }
+    }
+}
@@ -0,0 +1,35 @@
+#ifndef FDTABLE_H
+#define FDTABLE_H
+
+#include <vector>
+
+// Every pipe end the shell opens for running a line. They are all created close-on-exec, so an exec'd
+// child only keeps the ends it dup'ed onto stdin/stdout. A child that keeps running shell code
+// (subshells, repeaters) drops the rest with closeAll().
+class FdTable {
+public:
+    // Returns false if the pipe couldn't be created
+    bool openPipe(int& readFd, int& writeFd);
+    // A close-on-exec file in memory (memfd) to write output into and read it back, -1 where there are none
+    int openMemoryFile(const char* name);
+
+    // Closes a tracked fd and forgets it
+    int close(int fd);
+
+    // Stops tracking an fd that now belongs to someone else (who will close it)
+    void forget(int fd);
+
+    void closeAll();
+
+    int count() const { return openCount; }
+
+private:
+    void track(int fd);
+
+    std::vector<bool> isOpen;
+    int openCount = 0;
+};
+
+extern FdTable shellFds;
+
+#endif //FDTABLE_H
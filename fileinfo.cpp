@@ -0,0 +1,57 @@
+#include "fileinfo.h"
+#include <algorithm>
+#include <string.h>
+
+using namespace std;
+
+long long modificationTime(const struct stat& st){
+#ifdef __APPLE__
+    return st.st_mtimespec.tv_sec * 1000000000LL + st.st_mtimespec.tv_nsec;
+#else
+    return st.st_mtim.tv_sec * 1000000000LL + st.st_mtim.tv_nsec;
+#endif
+}
+
+long long changeTime(const struct stat& st){
+#ifdef __APPLE__
+    return st.st_ctimespec.tv_sec * 1000000000LL + st.st_ctimespec.tv_nsec;
+#else
+    return st.st_ctim.tv_sec * 1000000000LL + st.st_ctim.tv_nsec;
+#endif
+}
+
+vector<string> lineWords(const string& line){
+    vector<string> words;
+    string word;
+
+    for(size_t i = 0; i <= line.size(); i++){
+        auto c = i < line.size() ? line[i] : ' ';
+        if(!strchr(" \t|,;()\"'&", c)){
+            word += c;
+            continue;
+        }
+
+        // "[grep x f]" is a shard around "grep x f", "*.[ch]" a wildcard: only unmatched brackets go
+        auto opened = count(word.begin(), word.end(), '[') - count(word.begin(), word.end(), ']');
+        for(; opened > 0 && !word.empty() && word[0] == '['; opened--){
+            word.erase(0, 1);
+        }
+        for(; opened < 0 && !word.empty() && word[word.size() - 1] == ']'; opened++){
+            word.erase(word.size() - 1);
+        }
+        if(!word.empty()){
+            words.push_back(word);
+        }
+        word.clear();
+    }
+    return words;
+}
+
+uint64_t hashBytes(const char* data, size_t size){
+    uint64_t hash = 14695981039346656037ULL;
+    for(size_t i = 0; i < size; i++){
+        hash ^= (unsigned char)data[i];
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
@@ -0,0 +1,24 @@
+#ifndef FILEINFO_H
+#define FILEINFO_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <sys/stat.h>
+
+// What the journal, --watch and the wildcard cache all need to know about the files a line names
+
+// Last modification and last status change of a stat result, in nanoseconds
+long long modificationTime(const struct stat& st);
+long long changeTime(const struct stat& st);
+
+// The words of line that may name files or wildcards, whatever they are used for, in order and with
+// repeats. Words are split at the shell's separators and quotes, so the files of subshells, shards and
+// substitutions count as well. A shard's brackets are dropped, a wildcard's are kept.
+std::vector<std::string> lineWords(const std::string& line);
+
+// FNV-1a of size bytes at data
+uint64_t hashBytes(const char* data, size_t size);
+
+#endif //FILEINFO_H
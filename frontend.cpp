@@ -0,0 +1,120 @@
+#include "frontend.h"
+#include <unistd.h>
+#include <errno.h>
+
+using namespace std;
+
+ScriptFrontEnd::ScriptFrontEnd(int fd, size_t lookahead, ExecutableReadahead* readahead)
+    : fd(fd), lookahead(lookahead > 0 ? lookahead : 1), readahead(readahead), eof(false)
+{
+    thread = std::thread(&ScriptFrontEnd::run, this);
+}
+
+ScriptFrontEnd::~ScriptFrontEnd(){
+    // The reader stops by itself after the end marker, unblock it if we quit before that.
+    {
+        lock_guard<mutex> lock(queueMutex);
+        lookahead = (size_t)-1;
+    }
+    notFull.notify_all();
+    thread.join();
+
+    for(auto& line : queue){
+        if(line.input){
+            free_parsed_input(line.input);
+            delete line.input;
+        }
+    }
+}
+
+// Reads with read(2) rather than cin: forked children must never inherit a half-read stdio buffer
+// or a stream lock held by this thread.
+bool ScriptFrontEnd::readLine(string& line){
+    while(true){
+        auto newline = pending.find('\n');
+        if(newline != string::npos){
+            line.assign(pending, 0, newline);
+            pending.erase(0, newline + 1);
+            return true;
+        }
+
+        if(eof){
+            if(pending.empty()){
+                return false;
+            }
+            line.swap(pending);
+            pending.clear();
+            return true;
+        }
+
+        char chunk[65536];
+        auto count = read(fd, chunk, sizeof(chunk));
+        if(count < 0 && errno == EINTR){
+            continue;
+        }
+        if(count <= 0){
+            eof = true;
+        } else{
+            pending.append(chunk, count);
+        }
+    }
+}
+
+void ScriptFrontEnd::push(const ParsedLine& line){
+    unique_lock<mutex> lock(queueMutex);
+    notFull.wait(lock, [this]{ return queue.size() < lookahead; });
+    queue.push_back(line);
+    notEmpty.notify_one();
+}
+
+void ScriptFrontEnd::run(){
+    string text;
+
+    while(readLine(text)){
+        if(text.empty()){
+            continue;
+        }
+
+        ParsedLine line;
+        line.text = text;
+        line.isEnd = text == "quit";
+        line.input = NULL;
+
+        if(!line.isEnd){
+            char error[PARSE_ERROR_SIZE];
+            line.input = new parsed_input;
+            auto success = parse_line_r(const_cast<char*>(text.c_str()), line.input, error, sizeof(error));
+            line.error = error;
+
+            if(!success || line.input->num_inputs <= 0){
+                free_parsed_input(line.input);
+                delete line.input;
+                line.input = NULL;
+            }
+        }
+        if(readahead != NULL && line.input != NULL){
+            line.readAhead = readahead->prefetch(line.input);
+        }
+
+        push(line);
+
+        // The executor stops at quit, nothing after it runs. A line that didn't parse stops it too, unless
+        // it's a builtin with its own syntax (explain), so reading goes on after one.
+        if(line.isEnd){
+            return;
+        }
+    }
+
+    ParsedLine end;
+    end.input = NULL;
+    end.isEnd = true;
+    push(end);
+}
+
+void ScriptFrontEnd::next(ParsedLine& line){
+    unique_lock<mutex> lock(queueMutex);
+    notEmpty.wait(lock, [this]{ return !queue.empty(); });
+    line = queue.front();
+    queue.pop_front();
+    notFull.notify_one();
+}
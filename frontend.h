@@ -0,0 +1,51 @@
+#ifndef FRONTEND_H
+#define FRONTEND_H
+
+#include <string>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <vector>
+#include "parser.h"
+#include "readahead.h"
+
+// One line of the script, already parsed by the front end thread.
+struct ParsedLine {
+    std::string text;
+    parsed_input* input;   // NULL if the line didn't parse
+    std::string error;     // Parser message for a line that didn't parse
+    bool isEnd;            // "quit" or end of input, nothing follows
+    std::vector<std::string> readAhead;   // Files the readahead started reading for this line
+};
+
+// Reads and parses script lines ahead on its own thread while the current line executes.
+// Lines come out of next() in input order, the executor still runs them one by one.
+// With a readahead, the programs of each line are warmed as soon as it's parsed (see readahead.h).
+class ScriptFrontEnd {
+public:
+    ScriptFrontEnd(int fd, size_t lookahead, ExecutableReadahead* readahead = NULL);
+    ~ScriptFrontEnd();
+
+    // Blocks until the next line is parsed. Caller owns line.input.
+    void next(ParsedLine& line);
+
+private:
+    void run();
+    bool readLine(std::string& line);
+    void push(const ParsedLine& line);
+
+    int fd;
+    size_t lookahead;
+    ExecutableReadahead* readahead;
+    std::string pending;
+    bool eof;
+
+    std::deque<ParsedLine> queue;
+    std::mutex queueMutex;
+    std::condition_variable notEmpty;
+    std::condition_variable notFull;
+    std::thread thread;
+};
+
+#endif //FRONTEND_H
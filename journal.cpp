@@ -0,0 +1,167 @@
+#include "journal.h"
+#include "fileinfo.h"
+#include <iostream>
+#include <sstream>
+#include <set>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+using namespace std;
+
+namespace {
+
+// Files recorded per line at most, a line naming more only has its first ones checked
+const size_t MAX_INPUT_FILES = 32;
+
+unsigned long long hashLine(const string& line){
+    return hashBytes(line.data(), line.size());
+}
+
+// The words of the line that name regular files (see lineWords)
+vector<string> namedFiles(const string& line){
+    vector<string> files;
+    set<string> seen;
+
+    for(auto& word : lineWords(line)){
+        if(files.size() == MAX_INPUT_FILES){
+            break;
+        }
+        struct stat st;
+        if(seen.insert(word).second && stat(word.c_str(), &st) == 0 && S_ISREG(st.st_mode)){
+            files.push_back(word);
+        }
+    }
+    return files;
+}
+
+}
+
+Journal* Journal::open(const char* path, bool recheckInputs){
+    auto fd = ::open(path, O_RDWR | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+    if(fd < 0){
+        return NULL;
+    }
+    auto journal = new Journal(fd, recheckInputs);
+    journal->load();
+    return journal;
+}
+
+Journal::Journal(int fd, bool recheckInputs) : fd(fd), recheckInputs(recheckInputs){
+}
+
+Journal::~Journal(){
+    ::close(fd);
+}
+
+void Journal::load(){
+    string contents;
+    char buffer[64 * 1024];
+    ssize_t count;
+    while((count = pread(fd, buffer, sizeof(buffer), contents.size())) != 0){
+        if(count < 0 && errno == EINTR){
+            continue;
+        }
+        if(count < 0){
+            break;
+        }
+        contents.append(buffer, count);
+    }
+
+    // A record without its newline was cut off while being written, it and anything after it are dropped
+    size_t start = 0;
+    for(auto newline = contents.find('\n'); newline != string::npos; newline = contents.find('\n', start)){
+        istringstream fields(contents.substr(start, newline - start));
+        Entry entry;
+        long long milliseconds;
+        string hash;
+        if(!getline(fields, hash, '\t') || !(fields >> entry.status >> milliseconds)){
+            break;
+        }
+        entry.hash = strtoull(hash.c_str(), NULL, 16);
+        entry.offset = start;
+
+        fields.ignore(1);
+        InputFile input;
+        while(getline(fields, input.path, '\t') && fields >> input.mtime >> input.size){
+            entry.inputs.push_back(input);
+            fields.ignore(1);
+        }
+
+        entries.push_back(entry);
+        start = newline + 1;
+    }
+    end = start;
+}
+
+bool Journal::inputsUnchanged(const Entry& entry) const{
+    for(auto& input : entry.inputs){
+        struct stat st;
+        if(stat(input.path.c_str(), &st) != 0 || modificationTime(st) != input.mtime || st.st_size != input.size){
+            return false;
+        }
+    }
+    return true;
+}
+
+bool Journal::skip(const string& line){
+    if(!resuming){
+        return false;
+    }
+
+    if(position < entries.size()){
+        auto& entry = entries[position];
+        if(entry.hash == hashLine(line) && entry.status == 0 && (!recheckInputs || inputsUnchanged(entry))){
+            position++;
+            return true;
+        }
+    }
+
+    stopResuming();
+    return false;
+}
+
+// The rest of the old journal describes a run that's being redone
+void Journal::stopResuming(){
+    resuming = false;
+    auto cut = position < entries.size() ? entries[position].offset : end;
+    if(ftruncate(fd, cut) < 0){
+        cerr << "journal: " << strerror(errno) << endl;
+    }
+    if(position > 0){
+        cerr << "journal: skipped " << position << " line" << (position == 1 ? "" : "s") << " that already succeeded" << endl;
+    }
+    entries.clear();
+}
+
+void Journal::record(const string& line, int status, long long milliseconds){
+    char hash[17];
+    snprintf(hash, sizeof(hash), "%016llx", hashLine(line));
+    ostringstream text;
+    text << hash << '\t' << status << '\t' << milliseconds;
+    for(auto& path : namedFiles(line)){
+        struct stat st;
+        if(stat(path.c_str(), &st) == 0){
+            text << '\t' << path << '\t' << modificationTime(st) << '\t' << (long long)st.st_size;
+        }
+    }
+    text << '\n';
+
+    // One write per record, so a record is either all there or cut short, never interleaved
+    auto record = text.str();
+    size_t done = 0;
+    while(done < record.size()){
+        auto count = write(fd, record.data() + done, record.size() - done);
+        if(count < 0 && errno == EINTR){
+            continue;
+        }
+        if(count < 0){
+            cerr << "journal: " << strerror(errno) << endl;
+            return;
+        }
+        done += count;
+    }
+}
@@ -0,0 +1,60 @@
+#ifndef JOURNAL_H
+#define JOURNAL_H
+
+#include <string>
+#include <vector>
+#include <sys/types.h>
+
+// Checkpoints for long scripts. Every line that runs to completion is appended to the journal file with
+// its hash, exit status, run time and the files it named. Run the same script with the same journal again
+// and the lines that succeeded last time are skipped, up to the first one that failed or never finished;
+// from there on everything runs and the journal is rewritten. Lines are matched by position and hash,
+// so an edited script resumes at the first edited line.
+//
+// One record per line, tab separated:
+//   hash  status  milliseconds  [path  mtime  size]...
+// The file is written with plain appends: a record survives the shell being killed, not a power cut.
+class Journal {
+public:
+    // With recheckInputs, a line whose files changed size or mtime (or are gone) runs again, and so does
+    // everything after it. Returns NULL if the file can't be opened.
+    static Journal* open(const char* path, bool recheckInputs);
+    ~Journal();
+
+    // True if the line at the current position of the script can be skipped. The first false ends the
+    // resumed part for good.
+    bool skip(const std::string& line);
+
+    // The line ran and exited with status
+    void record(const std::string& line, int status, long long milliseconds);
+
+private:
+    struct InputFile {
+        std::string path;
+        long long mtime;
+        long long size;
+    };
+
+    struct Entry {
+        unsigned long long hash;
+        int status;
+        std::vector<InputFile> inputs;
+        // Where the record starts in the file
+        off_t offset;
+    };
+
+    Journal(int fd, bool recheckInputs);
+    void load();
+    bool inputsUnchanged(const Entry& entry) const;
+    void stopResuming();
+
+    int fd;
+    bool recheckInputs;
+    std::vector<Entry> entries;
+    // Offset just past the last complete record
+    off_t end = 0;
+    size_t position = 0;
+    bool resuming = true;
+};
+
+#endif //JOURNAL_H
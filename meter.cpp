@@ -0,0 +1,127 @@
+#include "meter.h"
+#include <iostream>
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <errno.h>
+#include <stdio.h>
+#include <sys/ioctl.h>
+#include <chrono>
+
+using namespace std;
+
+static double seconds(){
+    return chrono::duration<double>(chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+PipeRelay::PipeRelay(int readFd, int writeFd, const string& from, const string& to)
+    : readFd(readFd), writeFd(writeFd)
+{
+    result.from = from;
+    result.to = to;
+    result.bytes = 0;
+    result.seconds = 0;
+    result.upstreamWait = 0;
+    result.downstreamWait = 0;
+    result.peakQueued = 0;
+}
+
+void PipeRelay::start(){
+    thread = std::thread(&PipeRelay::run, this);
+}
+
+void PipeRelay::join(){
+    thread.join();
+}
+
+// Returns false if the fd hung up or failed instead of becoming ready
+bool PipeRelay::waitFor(int fd, short events, double& waited){
+    struct pollfd pfd;
+    pfd.fd = fd;
+    pfd.events = events;
+    pfd.revents = 0;
+
+    auto start = seconds();
+    int result;
+    do{
+        result = poll(&pfd, 1, -1);
+    } while(result < 0 && errno == EINTR);
+    waited += seconds() - start;
+
+    if(result < 0 || (pfd.revents & (POLLERR | POLLNVAL))){
+        return false;
+    }
+
+    // POLLHUP on the read side can still come with unread data
+    return (pfd.revents & events) || (events == POLLIN && (pfd.revents & POLLHUP));
+}
+
+void PipeRelay::run(){
+    auto start = seconds();
+    char buffer[65536];
+
+    fcntl(readFd, F_SETFL, fcntl(readFd, F_GETFL) | O_NONBLOCK);
+    fcntl(writeFd, F_SETFL, fcntl(writeFd, F_GETFL) | O_NONBLOCK);
+
+    while(true){
+        if(!waitFor(readFd, POLLIN, result.upstreamWait)){
+            break;
+        }
+        if(!waitFor(writeFd, POLLOUT, result.downstreamWait)){
+            break;
+        }
+
+        int queued = 0;
+        if(ioctl(writeFd, FIONREAD, &queued) == 0 && queued > result.peakQueued){
+            result.peakQueued = queued;
+        }
+
+#ifdef __linux__
+        // Moves the pages from one pipe to the other without copying them through the relay
+        auto moved = splice(readFd, NULL, writeFd, NULL, sizeof(buffer), SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+        if(moved < 0 && errno == EINVAL){
+            moved = read(readFd, buffer, sizeof(buffer));
+            if(moved > 0){
+                moved = write(writeFd, buffer, moved);
+            }
+        }
+#else
+        auto moved = read(readFd, buffer, sizeof(buffer));
+        if(moved > 0){
+            // Downstream was writable, a blocking write keeps the chunk whole
+            fcntl(writeFd, F_SETFL, fcntl(writeFd, F_GETFL) & ~O_NONBLOCK);
+            moved = write(writeFd, buffer, moved);
+            fcntl(writeFd, F_SETFL, fcntl(writeFd, F_GETFL) | O_NONBLOCK);
+        }
+#endif
+
+        if(moved == 0){
+            break;
+        }
+        if(moved < 0){
+            if(errno == EAGAIN || errno == EINTR){
+                continue;
+            }
+            // EPIPE: the reading stage is gone, closing our read end lets the writer get SIGPIPE too
+            break;
+        }
+
+        result.bytes += moved;
+    }
+
+    close(readFd);
+    close(writeFd);
+    result.seconds = seconds() - start;
+}
+
+void printMeterReport(const vector<PipeMeterStats>& stats){
+    for(auto& stat : stats){
+        auto rate = stat.seconds > 0 ? stat.bytes / stat.seconds / (1024.0 * 1024.0) : 0.0;
+        char line[512];
+        snprintf(line, sizeof(line),
+                 "meter: %s -> %s: %lld bytes in %.3fs (%.1f MiB/s), waiting on %s %.3fs, backpressure from %s %.3fs, peak queued %d bytes",
+                 stat.from.c_str(), stat.to.c_str(), stat.bytes, stat.seconds, rate,
+                 stat.from.c_str(), stat.upstreamWait, stat.to.c_str(), stat.downstreamWait, stat.peakQueued);
+        cerr << line << endl;
+    }
+}
@@ -0,0 +1,41 @@
+#ifndef METER_H
+#define METER_H
+
+#include <string>
+#include <vector>
+#include <thread>
+
+// Traffic through one pipe between two pipeline stages
+struct PipeMeterStats {
+    std::string from;
+    std::string to;
+    long long bytes;
+    double seconds;
+    double upstreamWait;    // Relay had nothing to forward, the writing stage is the slow one
+    double downstreamWait;  // Relay couldn't forward, the reading stage is the slow one (backpressure)
+    int peakQueued;         // Most bytes seen waiting in the downstream pipe
+};
+
+// Sits between two stages and forwards everything the first writes to the second while timing both sides.
+// Owns both fds and closes them when the writing stage is done or the reading stage is gone.
+class PipeRelay {
+public:
+    PipeRelay(int readFd, int writeFd, const std::string& from, const std::string& to);
+
+    void start();
+    void join();
+    const PipeMeterStats& stats() const { return result; }
+
+private:
+    void run();
+    bool waitFor(int fd, short events, double& waited);
+
+    int readFd;
+    int writeFd;
+    PipeMeterStats result;
+    std::thread thread;
+};
+
+void printMeterReport(const std::vector<PipeMeterStats>& stats);
+
+#endif //METER_H
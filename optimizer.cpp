@@ -0,0 +1,178 @@
+#include "optimizer.h"
+#include "shard.h"
+#include "wildcard.h"
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+using namespace std;
+
+namespace {
+
+string describe(const single_input& single){
+    if(single.type == INPUT_TYPE_SHARD){
+        return string("[") + single.data.subshell + "]";
+    }
+    return string("(") + single.data.subshell + ")";
+}
+
+string describe(const command& cmd){
+    string text;
+    for(int i = 0; i < MAX_ARGS && cmd.args[i] != NULL; i++){
+        text += (i == 0 ? "" : " ") + string(cmd.args[i]);
+    }
+    return text;
+}
+
+// Parses the commands of a subshell or shard. NULL if they don't parse, the executor reports that when it gets there.
+parsed_input* parseInner(const single_input& single){
+    char text[INPUT_BUFFER_SIZE];
+    strcpy(text, single.data.subshell);
+
+    char* commands = text;
+    if(single.type == INPUT_TYPE_SHARD){
+        ShardSpec spec;
+        commands = parseShardSpec(text, spec);
+        if(commands == NULL){
+            return NULL;
+        }
+    }
+
+    auto inner = new parsed_input;
+    char error[PARSE_ERROR_SIZE];
+    if(!parse_line_r(commands, inner, error, sizeof(error)) || inner->num_inputs == 0){
+        free_parsed_input(inner);
+        delete inner;
+        return NULL;
+    }
+    return inner;
+}
+
+// (X) as the whole line. This shell keeps no state a subshell could isolate (no cd, no variables), so the
+// forked shell only adds a process; its status is X's status, which runForInput returns directly.
+bool inlineLineSubshell(parsed_input* input, vector<string>& rewrites){
+    if(input->separator != SEPARATOR_NONE || input->num_inputs != 1 || input->inputs[0].type != INPUT_TYPE_SUBSHELL){
+        return false;
+    }
+
+    auto inner = parseInner(input->inputs[0]);
+    if(inner == NULL){
+        return false;
+    }
+
+    rewrites.push_back("ran subshell " + describe(input->inputs[0]) + " in the shell");
+    // A subshell owns no heap memory, the inner line's arguments move over as they are
+    *input = *inner;
+    delete inner;
+    return true;
+}
+
+// A pipeline stage (X) or [X], where X is one command, a subshell or a pipeline. The stage's shell only
+// passes its stdin and stdout on to X, so X's stages can sit in the outer pipeline instead. The pipeline's
+// status is still that of its last command. A shard with one worker hands it every line, like a plain pipe.
+// Groups with , or ; stay: a parallel group is a repeater or a real shard, a sequence needs its shell.
+bool flattenPipelineStages(parsed_input* input, vector<string>& rewrites){
+    if(input->separator != SEPARATOR_PIPE){
+        return false;
+    }
+
+    auto changed = false;
+    for(int i = 0; i < input->num_inputs; i++){
+        auto& stage = input->inputs[i];
+        if(stage.type != INPUT_TYPE_SUBSHELL && stage.type != INPUT_TYPE_SHARD){
+            continue;
+        }
+
+        auto inner = parseInner(stage);
+        if(inner == NULL){
+            continue;
+        }
+        auto splices = inner->separator == SEPARATOR_PIPE ||
+                       (inner->separator == SEPARATOR_NONE && inner->inputs[0].type != INPUT_TYPE_PIPELINE);
+        if(!splices || input->num_inputs - 1 + inner->num_inputs > MAX_INPUTS){
+            free_parsed_input(inner);
+            delete inner;
+            continue;
+        }
+
+        if(stage.type == INPUT_TYPE_SHARD){
+            rewrites.push_back("replaced one-worker shard " + describe(stage) + " with a pipe");
+        } else{
+            rewrites.push_back("spliced subshell " + describe(stage) + " into the pipeline");
+        }
+
+        // Make room and move the inner stages in, the subshell itself owns nothing
+        auto extra = inner->num_inputs - 1;
+        for(int j = input->num_inputs - 1; j > i; j--){
+            input->inputs[j + extra] = input->inputs[j];
+        }
+        for(int j = 0; j < inner->num_inputs; j++){
+            input->inputs[i + j] = inner->inputs[j];
+        }
+        input->num_inputs += extra;
+        delete inner;
+
+        changed = true;
+        // The first spliced stage may be a subshell again
+        i--;
+    }
+    return changed;
+}
+
+// cat copies FILE to its stdout unchanged, so the next command may as well read FILE itself. Only a
+// plain "cat FILE" of a readable regular file qualifies: options, several files, "-", substitutions and
+// unmatched wildcards keep their cat, and so does a cat whose next stage already reads a file.
+bool isCatOfFile(const command& cat, const command& next){
+    if(cat.argv != NULL || next.input_file != NULL || strcmp(cat.args[0], "cat") != 0 ||
+       cat.args[1] == NULL || cat.args[2] != NULL){
+        return false;
+    }
+
+    const char* file = cat.args[1];
+    if((cat.substituted & 2u) || file[0] == '-' || (!(cat.quoted & 2u) && hasWildcard(file))){
+        return false;
+    }
+
+    struct stat st;
+    return stat(file, &st) == 0 && S_ISREG(st.st_mode) && access(file, R_OK) == 0;
+}
+
+// Hands the file of "cat FILE" to next as its stdin and frees the rest of the cat
+void dropCat(command& cat, command& next, vector<string>& rewrites){
+    rewrites.push_back("dropped \"" + describe(cat) + "\", " + next.args[0] + " reads " + cat.args[1]);
+    next.input_file = cat.args[1];
+    cat.args[1] = NULL;
+    free_command(&cat);
+}
+
+// Only a line that is one pipeline: the file is checked now, and in a sequence or a parallel group another
+// step could remove or change it before the pipeline starts
+bool dropCatHeads(parsed_input* input, vector<string>& rewrites){
+    if(input->separator != SEPARATOR_PIPE){
+        return false;
+    }
+
+    auto changed = false;
+    while(input->num_inputs > 1 && input->inputs[0].type == INPUT_TYPE_COMMAND &&
+          input->inputs[1].type == INPUT_TYPE_COMMAND &&
+          isCatOfFile(input->inputs[0].data.cmd, input->inputs[1].data.cmd)){
+        dropCat(input->inputs[0].data.cmd, input->inputs[1].data.cmd, rewrites);
+        for(int j = 1; j < input->num_inputs; j++){
+            input->inputs[j - 1] = input->inputs[j];
+        }
+        input->num_inputs--;
+        changed = true;
+    }
+    if(input->num_inputs == 1){
+        input->separator = SEPARATOR_NONE;
+    }
+    return changed;
+}
+
+}
+
+void optimizeLine(parsed_input* input, vector<string>& rewrites){
+    while(inlineLineSubshell(input, rewrites));
+    flattenPipelineStages(input, rewrites);
+    dropCatHeads(input, rewrites);
+}
@@ -0,0 +1,17 @@
+#ifndef OPTIMIZER_H
+#define OPTIMIZER_H
+
+#include <string>
+#include <vector>
+#include "parser.h"
+
+// Rewrites a parsed line into one that does the same with fewer processes and copies:
+//  - a whole line (X) runs X directly instead of forking a shell for it
+//  - a pipeline stage (X) or one-worker shard [X], where X is a command or a pipeline, becomes those
+//    stages of the outer pipeline (so a one-consumer repeater is a plain pipe)
+//  - a "cat FILE |" head of a line that is a single pipeline is dropped and the next command reads FILE
+//    as its stdin
+// A description of every rewrite that fired is appended to rewrites.
+void optimizeLine(parsed_input* input, std::vector<std::string>& rewrites);
+
+#endif //OPTIMIZER_H
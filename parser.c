@@ -1,14 +1,271 @@
 #include "parser.h"
+#include <stdint.h>
+#include <stdarg.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define SCAN_HAVE_X86 1
+#else
+#define SCAN_HAVE_X86 0
+#endif
+
+/*
+ * Character classes found by the pre-scan. The state machine below only needs to stop
+ * on these, everything in between is copied into the token buffer in one go.
+ */
+enum {
+    SCAN_SPACE,
+    SCAN_SEP,       /* ; , | & */
+    SCAN_DQUOTE,
+    SCAN_SQUOTE,
+    SCAN_RPAREN,
+    SCAN_RBRACKET,
+    SCAN_LPAREN,
+    SCAN_CLASS_COUNT
+};
+
+#define SCAN_BIT(c) (1u << (c))
+
+/* What write_buffer records about a word, see command.quoted and command.substituted */
+#define WORD_QUOTED 1
+#define WORD_SUBSTITUTED 2
+#define SCAN_BLOCK 64
+
+typedef struct {
+    size_t length;
+    size_t words;
+    uint64_t *bits[SCAN_CLASS_COUNT];
+    uint64_t *storage;
+} line_scan;
+
+typedef void (*scan_block_fn)(const unsigned char *block, uint64_t out[SCAN_CLASS_COUNT]);
+
+static SCAN_MODE requested_scan_mode = SCAN_MODE_AUTO;
+
+/* Argument strings handed out by write_buffer and released by free_command */
+static long live_arg_bytes = 0;
+static long live_arg_blocks = 0;
+static long total_arg_allocations = 0;
+
+static void scan_block_scalar(const unsigned char *block, uint64_t out[SCAN_CLASS_COUNT]) {
+    for ( int c=0; c<SCAN_CLASS_COUNT; c++ )
+        out[c] = 0;
+    for ( int i=0; i<SCAN_BLOCK; i++ ) {
+        uint64_t bit = (uint64_t)1 << i;
+        switch ( block[i] ) {
+            case ' ': case '\t': case '\n': case '\v': case '\f': case '\r':
+                out[SCAN_SPACE] |= bit;
+                break;
+            case ';': case ',': case '|': case '&':
+                out[SCAN_SEP] |= bit;
+                break;
+            case '"':
+                out[SCAN_DQUOTE] |= bit;
+                break;
+            case '\'':
+                out[SCAN_SQUOTE] |= bit;
+                break;
+            case ')':
+                out[SCAN_RPAREN] |= bit;
+                break;
+            case ']':
+                out[SCAN_RBRACKET] |= bit;
+                break;
+            case '(':
+                out[SCAN_LPAREN] |= bit;
+                break;
+            default:
+                break;
+        }
+    }
+}
+
+#if SCAN_HAVE_X86
+static void scan_block_sse2(const unsigned char *block, uint64_t out[SCAN_CLASS_COUNT]) {
+    for ( int c=0; c<SCAN_CLASS_COUNT; c++ )
+        out[c] = 0;
+    for ( int i=0; i<SCAN_BLOCK; i+=16 ) {
+        __m128i v = _mm_loadu_si128((const __m128i *)(block+i));
+        /* isspace() in the C locale: ' ' and '\t'..'\r' */
+        __m128i ctrl = _mm_sub_epi8(v, _mm_set1_epi8('\t'));
+        __m128i space = _mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8(' ')),
+                                     _mm_cmpeq_epi8(_mm_min_epu8(ctrl, _mm_set1_epi8(4)), ctrl));
+        __m128i sep = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8(';')),
+                                                _mm_cmpeq_epi8(v, _mm_set1_epi8(','))),
+                                   _mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8('|')),
+                                                _mm_cmpeq_epi8(v, _mm_set1_epi8('&'))));
+        out[SCAN_SPACE] |= (uint64_t)(uint16_t)_mm_movemask_epi8(space) << i;
+        out[SCAN_SEP] |= (uint64_t)(uint16_t)_mm_movemask_epi8(sep) << i;
+        out[SCAN_DQUOTE] |= (uint64_t)(uint16_t)_mm_movemask_epi8(_mm_cmpeq_epi8(v, _mm_set1_epi8('"'))) << i;
+        out[SCAN_SQUOTE] |= (uint64_t)(uint16_t)_mm_movemask_epi8(_mm_cmpeq_epi8(v, _mm_set1_epi8('\''))) << i;
+        out[SCAN_RPAREN] |= (uint64_t)(uint16_t)_mm_movemask_epi8(_mm_cmpeq_epi8(v, _mm_set1_epi8(')'))) << i;
+        out[SCAN_RBRACKET] |= (uint64_t)(uint16_t)_mm_movemask_epi8(_mm_cmpeq_epi8(v, _mm_set1_epi8(']'))) << i;
+        out[SCAN_LPAREN] |= (uint64_t)(uint16_t)_mm_movemask_epi8(_mm_cmpeq_epi8(v, _mm_set1_epi8('('))) << i;
+    }
+}
+
+__attribute__((target("avx2")))
+static void scan_block_avx2(const unsigned char *block, uint64_t out[SCAN_CLASS_COUNT]) {
+    for ( int c=0; c<SCAN_CLASS_COUNT; c++ )
+        out[c] = 0;
+    for ( int i=0; i<SCAN_BLOCK; i+=32 ) {
+        __m256i v = _mm256_loadu_si256((const __m256i *)(block+i));
+        __m256i ctrl = _mm256_sub_epi8(v, _mm256_set1_epi8('\t'));
+        __m256i space = _mm256_or_si256(_mm256_cmpeq_epi8(v, _mm256_set1_epi8(' ')),
+                                        _mm256_cmpeq_epi8(_mm256_min_epu8(ctrl, _mm256_set1_epi8(4)), ctrl));
+        __m256i sep = _mm256_or_si256(_mm256_or_si256(_mm256_cmpeq_epi8(v, _mm256_set1_epi8(';')),
+                                                       _mm256_cmpeq_epi8(v, _mm256_set1_epi8(','))),
+                                      _mm256_or_si256(_mm256_cmpeq_epi8(v, _mm256_set1_epi8('|')),
+                                                      _mm256_cmpeq_epi8(v, _mm256_set1_epi8('&'))));
+        out[SCAN_SPACE] |= (uint64_t)(uint32_t)_mm256_movemask_epi8(space) << i;
+        out[SCAN_SEP] |= (uint64_t)(uint32_t)_mm256_movemask_epi8(sep) << i;
+        out[SCAN_DQUOTE] |= (uint64_t)(uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(v, _mm256_set1_epi8('"'))) << i;
+        out[SCAN_SQUOTE] |= (uint64_t)(uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(v, _mm256_set1_epi8('\''))) << i;
+        out[SCAN_RPAREN] |= (uint64_t)(uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(v, _mm256_set1_epi8(')'))) << i;
+        out[SCAN_RBRACKET] |= (uint64_t)(uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(v, _mm256_set1_epi8(']'))) << i;
+        out[SCAN_LPAREN] |= (uint64_t)(uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(v, _mm256_set1_epi8('('))) << i;
+    }
+}
+#endif
+
+void parser_set_scan_mode(SCAN_MODE mode) {
+    requested_scan_mode = mode;
+}
+
+SCAN_MODE parser_active_scan_mode(void) {
+    SCAN_MODE mode = requested_scan_mode;
+#if SCAN_HAVE_X86
+    if ( mode == SCAN_MODE_AUTO )
+        mode = __builtin_cpu_supports("avx2") ? SCAN_MODE_AVX2 : SCAN_MODE_SSE2;
+    if ( mode == SCAN_MODE_AVX2 && !__builtin_cpu_supports("avx2") )
+        mode = SCAN_MODE_SSE2;
+#else
+    if ( mode == SCAN_MODE_AUTO || mode == SCAN_MODE_SSE2 || mode == SCAN_MODE_AVX2 )
+        mode = SCAN_MODE_SCALAR;
+#endif
+    return mode;
+}
 
 /***
- * Checks whether the inputs contain a subshell to
- * prevent subshells being chained with a seq or para separator
+ * Classifies the whole line in 64 byte blocks and fills one bitmap per character class.
+ * The last partial block is padded with zeroes, which do not belong to any class.
+ * Returns 0 if the pre-scan is disabled or could not allocate, the parser then goes char by char.
+ * @param line
+ * @param scan
+ * @return
+ */
+static int scan_line(const char *line, line_scan *scan) {
+    scan_block_fn kernel;
+    switch ( parser_active_scan_mode() ) {
+#if SCAN_HAVE_X86
+        case SCAN_MODE_AVX2: kernel = scan_block_avx2; break;
+        case SCAN_MODE_SSE2: kernel = scan_block_sse2; break;
+#endif
+        case SCAN_MODE_SCALAR: kernel = scan_block_scalar; break;
+        default: return 0;
+    }
+
+    scan->length = strlen(line);
+    scan->words = scan->length/SCAN_BLOCK + 1;
+    scan->storage = (uint64_t *)malloc(scan->words*SCAN_CLASS_COUNT*sizeof(uint64_t));
+    if ( scan->storage == NULL )
+        return 0;
+    for ( int c=0; c<SCAN_CLASS_COUNT; c++ )
+        scan->bits[c] = scan->storage + c*scan->words;
+
+    const unsigned char *src = (const unsigned char *)line;
+    uint64_t out[SCAN_CLASS_COUNT];
+    for ( size_t w=0; w<scan->words; w++ ) {
+        size_t offset = w*SCAN_BLOCK;
+        if ( offset + SCAN_BLOCK <= scan->length ) {
+            kernel(src+offset, out);
+        }
+        else {
+            unsigned char tail[SCAN_BLOCK];
+            memset(tail, 0, SCAN_BLOCK);
+            memcpy(tail, src+offset, scan->length-offset);
+            kernel(tail, out);
+        }
+        for ( int c=0; c<SCAN_CLASS_COUNT; c++ )
+            scan->bits[c][w] = out[c];
+    }
+    return 1;
+}
+
+/***
+ * Returns the first position at or after pos whose class is (or with invert, is not) in classes.
+ * Returns the line length if there is none.
+ */
+static size_t scan_next(const line_scan *scan, size_t pos, unsigned classes, int invert) {
+    size_t w = pos/SCAN_BLOCK;
+    uint64_t skip = ((uint64_t)1 << (pos%SCAN_BLOCK)) - 1;
+    for ( ; w<scan->words; w++, skip=0 ) {
+        uint64_t word = 0;
+        for ( int c=0; c<SCAN_CLASS_COUNT; c++ )
+            if ( classes & SCAN_BIT(c) )
+                word |= scan->bits[c][w];
+        if ( invert )
+            word = ~word;
+        word &= ~skip;
+        if ( word ) {
+            size_t found = w*SCAN_BLOCK + (size_t)__builtin_ctzll(word);
+            return found < scan->length ? found : scan->length;
+        }
+    }
+    return scan->length;
+}
+
+/***
+ * Records a parse error message in the caller's buffer instead of printing it,
+ * so that parsing can run ahead on another thread without reordering the output.
+ * Always returns 0 so it can be returned directly.
+ */
+static int parse_error(char *error, size_t error_size, const char *format, ...) {
+    if ( error != NULL && error_size > 0 ) {
+        va_list args;
+        va_start(args, format);
+        vsnprintf(error, error_size, format, args);
+        va_end(args);
+    }
+    return 0;
+}
+
+/***
+ * Appends count characters to the token buffer, failing instead of overflowing it.
+ */
+static int append_to_buffer(char *buffer, int *buffer_index, const char *src, size_t count,
+                            char *error, size_t error_size) {
+    if ( *buffer_index + count >= INPUT_BUFFER_SIZE )
+        return parse_error(error, error_size, "Arguments and subshells cannot be longer than %d characters.",
+                           INPUT_BUFFER_SIZE-1);
+    memcpy(buffer + *buffer_index, src, count);
+    *buffer_index += (int)count;
+    return 1;
+}
+
+/***
+ * Copies the run starting at current_char up to the next character in stop_classes into the buffer.
+ * Moves current_char onto that character so the state machine handles it next.
+ */
+static int consume_run(const line_scan *scan, char *line, char **current_char, unsigned stop_classes,
+                       char *buffer, int *buffer_index, char *error, size_t error_size) {
+    size_t pos = *current_char - line;
+    size_t stop = scan_next(scan, pos, stop_classes, 0);
+    if ( !append_to_buffer(buffer, buffer_index, *current_char, stop-pos, error, error_size) )
+        return 0;
+    *current_char = line + stop;
+    return 1;
+}
+
+/***
+ * Checks whether the inputs contain a subshell (or a shard) to prevent a pipeline
+ * with subshell stages being chained with a seq or para separator
  * @param input
  * @return bool
  */
 int check_subshell(parsed_input* input) {
     for ( int i=0; i<input->num_inputs; i++ ) {
-        if ( input->inputs[i].type == INPUT_TYPE_SUBSHELL )
+        if ( input->inputs[i].type == INPUT_TYPE_SUBSHELL || input->inputs[i].type == INPUT_TYPE_SHARD )
             return 1;
     }
     return 0;
@@ -26,7 +283,7 @@ void convert_to_pipeline(parsed_input* input) {
 
     pipeline1.num_commands = input->num_inputs;
     for ( int i=0; i<input->num_inputs; i++ )
-        memcpy(pipeline1.commands[i].args, input->inputs[i].data.cmd.args, MAX_INPUTS*sizeof(char*));
+        pipeline1.commands[i] = input->inputs[i].data.cmd;
 
     input->num_inputs = 1;
     input->inputs[0].type = INPUT_TYPE_PIPELINE;
@@ -42,19 +299,50 @@ void convert_command_to_pipeline(parsed_input* input) {
     pipeline pipeline1;
     memset(&pipeline1, 0, sizeof(pipeline));
     pipeline1.num_commands = 1;
-    memcpy(pipeline1.commands[0].args, input->inputs[input_index].data.cmd.args, MAX_INPUTS*sizeof(char*));
+    pipeline1.commands[0] = input->inputs[input_index].data.cmd;
 
     input->inputs[input_index].type = INPUT_TYPE_PIPELINE;
     memcpy(&(input->inputs[input_index].data.pline), &pipeline1, sizeof(pipeline));
 }
 
+/***
+ * Allocates a copy of an argument and accounts for it, see parser_allocation_stats
+ * @param buffer
+ * @return
+ */
+static char *copy_argument(const char *buffer) {
+    size_t size = strlen(buffer)+1;
+    char *copy = (char *)calloc(size, sizeof(char));
+    strcpy(copy, buffer);
+    __atomic_add_fetch(&live_arg_bytes, (long)size, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&live_arg_blocks, 1, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&total_arg_allocations, 1, __ATOMIC_RELAXED);
+    return copy;
+}
+
+static void free_argument(char *argument) {
+    __atomic_sub_fetch(&live_arg_bytes, (long)(strlen(argument)+1), __ATOMIC_RELAXED);
+    __atomic_sub_fetch(&live_arg_blocks, 1, __ATOMIC_RELAXED);
+    free(argument);
+}
+
+void parser_allocation_stats(long *live_bytes, long *live_blocks, long *total_allocations) {
+    *live_bytes = __atomic_load_n(&live_arg_bytes, __ATOMIC_RELAXED);
+    *live_blocks = __atomic_load_n(&live_arg_blocks, __ATOMIC_RELAXED);
+    *total_allocations = __atomic_load_n(&total_arg_allocations, __ATOMIC_RELAXED);
+}
+
 /***
  * Fills the current input's command or argument with the current buffer
  * @param input
  * @param buffer
  * @param is_command
+ * @param word_flags WORD_QUOTED and WORD_SUBSTITUTED bits for the word, cleared once it is written
  */
-void write_buffer(parsed_input* input, char *buffer, int is_command, int is_pipeline) {
+void write_buffer(parsed_input* input, char *buffer, int is_command, int is_pipeline, int *word_flags) {
+    int flags = *word_flags;
+    command *cmd;
+    *word_flags = 0;
     int input_index;
     int arg_index;
     int current_command;
@@ -78,25 +366,55 @@ void write_buffer(parsed_input* input, char *buffer, int is_command, int is_pipe
         }
     }
     if ( input->inputs[input_index].type == INPUT_TYPE_PIPELINE ) {
-        input->inputs[input_index].data.pline.commands[current_command].args[arg_index] =
-                (char *)calloc(strlen(buffer), sizeof(char));
-        strcpy(input->inputs[input_index].data.pline.commands[current_command].args[arg_index],
-               buffer);
-        input->inputs[input_index].data.pline.commands[current_command].args[arg_index+1] = NULL;
+        cmd = &input->inputs[input_index].data.pline.commands[current_command];
+        cmd->args[arg_index] = copy_argument(buffer);
+        cmd->args[arg_index+1] = NULL;
         if ( is_command )
             input->inputs[input_index].data.pline.num_commands++;
     }
     else {
         input->inputs[input_index].type = INPUT_TYPE_COMMAND;
-        input->inputs[input_index].data.cmd.args[arg_index] = (char *)calloc(strlen(buffer), sizeof(char));
-        strcpy(input->inputs[input_index].data.cmd.args[arg_index], buffer);
-        input->inputs[input_index].data.cmd.args[arg_index+1] = NULL;
+        cmd = &input->inputs[input_index].data.cmd;
+        cmd->args[arg_index] = copy_argument(buffer);
+        cmd->args[arg_index+1] = NULL;
         if ( is_command )
             input->num_inputs++;
     }
+    if ( flags & WORD_QUOTED )
+        cmd->quoted |= 1u << arg_index;
+    if ( flags & WORD_SUBSTITUTED )
+        cmd->substituted |= 1u << arg_index;
 }
 
-int parse_line(char *line, parsed_input *input) {
+/***
+ * Copies a command substitution from its '(' to the matching ')' into the token buffer. Parentheses
+ * and quotes inside it are skipped over, the executor parses and runs the command later.
+ */
+static int consume_substitution(char **current_char, char *buffer, int *buffer_index, char *error, size_t error_size) {
+    char *end = *current_char;
+    int depth = 0;
+    char quote = 0;
+    for ( ; *end; end++ ) {
+        if ( quote ) {
+            if ( *end == quote )
+                quote = 0;
+        }
+        else if ( *end == '"' || *end == '\'' )
+            quote = *end;
+        else if ( *end == '(' )
+            depth++;
+        else if ( *end == ')' && --depth == 0 )
+            break;
+    }
+    if ( !*end )
+        return parse_error(error, error_size, "Command substitution is missing its closing parenthesis.");
+    if ( !append_to_buffer(buffer, buffer_index, *current_char, end+1-*current_char, error, error_size) )
+        return 0;
+    *current_char = end+1;
+    return 1;
+}
+
+static int parse_line_scanned(char *line, parsed_input *input, const line_scan *scan, char *error, size_t error_size) {
     char *current_char;
     int buffer_index = 0;
     char buffer[INPUT_BUFFER_SIZE];
@@ -109,6 +427,8 @@ int parse_line(char *line, parsed_input *input) {
     char quote_char = 0;
 
     int is_subshell = 0;
+    char subshell_close = 0; /* ')' for a subshell, ']' for a shard */
+    int word_flags = 0;
 
     int is_free = 1;
     int is_waiting_command = 1;
@@ -120,45 +440,79 @@ int parse_line(char *line, parsed_input *input) {
 
     int is_pipeline = 0;
     while ( *current_char ) {
+        /* && and || separate a sequence like ; does, but make the next input depend on the last status */
+        SEPARATOR link = SEPARATOR_SEQ;
+        if ( !is_quote && !is_subshell && (*current_char == '&' || *current_char == '|') && current_char[1] == *current_char )
+            link = *current_char == '&' ? SEPARATOR_AND : SEPARATOR_OR;
+        int is_sequential = *current_char == ';' || link != SEPARATOR_SEQ;
+
         if ( is_quote ) {
             if ( *current_char == quote_char ) {
                 buffer[buffer_index] = '\0';
                 buffer_index = 0;
                 is_quote = 0;
+                word_flags |= WORD_QUOTED;
+                if ( quote_char == '"' && strstr(buffer, "$(") )
+                    word_flags |= WORD_SUBSTITUTED;
                 quote_char = 0;
-                write_buffer(input, buffer, is_reading_command, is_pipeline);
+                write_buffer(input, buffer, is_reading_command, is_pipeline, &word_flags);
                 is_reading_command = 0;
                 is_reading_arg = 0;
                 is_waiting_arg = 1;
                 is_free = 1;
             }
+            else if ( scan ) {
+                if ( !consume_run(scan, line, &current_char, quote_char == '"' ? SCAN_BIT(SCAN_DQUOTE) : SCAN_BIT(SCAN_SQUOTE),
+                                  buffer, &buffer_index, error, error_size) )
+                    return 0;
+                continue;
+            }
             else {
-                buffer[buffer_index++] = *current_char;
+                if ( !append_to_buffer(buffer, &buffer_index, current_char, 1, error, error_size) )
+                    return 0;
             }
         }
         else if ( is_subshell ) {
-            if ( *current_char == ')' ) {
+            if ( *current_char == subshell_close ) {
                 buffer[buffer_index] = '\0';
-                if (input->separator == SEPARATOR_PARA || input->separator == SEPARATOR_SEQ ) {
-                    fprintf(stderr, "Subshells cannot be chained with a sequential or parallel operation.\n");
-                    return 0;
+                /* In a sequence or parallel group a subshell is a whole input, a pipeline there only holds commands */
+                if ( is_pipeline ) {
+                    return parse_error(error, error_size, "Subshells cannot be piped inside a sequential or parallel operation.");
                 }
                 int input_index = input->num_inputs;
-                input->inputs[input_index].type = INPUT_TYPE_SUBSHELL;
+                input->inputs[input_index].type = subshell_close == ')' ? INPUT_TYPE_SUBSHELL : INPUT_TYPE_SHARD;
                 strcpy(input->inputs[input_index].data.subshell, buffer);
                 input->num_inputs++;
                 buffer_index = 0;
                 is_subshell = 0;
+                subshell_close = 0;
                 is_free = 1;
                 is_waiting_sep = 1;
             }
+            /* A $(...) in the body is copied whole, its ')' doesn't close the subshell */
+            else if ( *current_char == '(' && buffer_index > 0 && buffer[buffer_index-1] == '$' ) {
+                if ( !consume_substitution(&current_char, buffer, &buffer_index, error, error_size) )
+                    return 0;
+                continue;
+            }
+            else if ( scan && *current_char != '(' ) {
+                if ( !consume_run(scan, line, &current_char,
+                                  (subshell_close == ')' ? SCAN_BIT(SCAN_RPAREN) : SCAN_BIT(SCAN_RBRACKET)) | SCAN_BIT(SCAN_LPAREN),
+                                  buffer, &buffer_index, error, error_size) )
+                    return 0;
+                continue;
+            }
             else {
-                buffer[buffer_index++] = *current_char;
+                if ( !append_to_buffer(buffer, &buffer_index, current_char, 1, error, error_size) )
+                    return 0;
             }
         }
         else if ( is_free ) {
             if (isspace(*current_char)) {
-                current_char++;
+                if ( scan )
+                    current_char = line + scan_next(scan, current_char - line, SCAN_BIT(SCAN_SPACE), 1);
+                else
+                    current_char++;
                 continue;
             }
             if ( is_waiting_command ) {
@@ -172,25 +526,34 @@ int parse_line(char *line, parsed_input *input) {
                 else if ( *current_char == '(' ) {
                     is_free = 0;
                     is_subshell = 1;
+                    subshell_close = ')';
                     is_waiting_command = 0;
                 }
-                else if ( *current_char == ';' ) {
-                    fprintf(stderr, "There should be a command or a pipeline before semicolon.\n");
-                    return 0;
+                /* Only a pipeline stage can be a shard, anywhere else [ is the test command */
+                else if ( *current_char == '[' && input->separator == SEPARATOR_PIPE ) {
+                    is_free = 0;
+                    is_subshell = 1;
+                    subshell_close = ']';
+                    is_waiting_command = 0;
+                }
+                else if ( link != SEPARATOR_SEQ ) {
+                    return parse_error(error, error_size, "There should be a command or a pipeline before && or ||.");
+                }
+                else if ( is_sequential ) {
+                    return parse_error(error, error_size, "There should be a command or a pipeline before semicolon.");
                 }
                 else if ( *current_char == ',' ) {
-                    fprintf(stderr, "There should be a command or a pipeline before comma.\n");
-                    return 0;
+                    return parse_error(error, error_size, "There should be a command or a pipeline before comma.");
                 }
                 else if ( *current_char == '|' ) {
-                    fprintf(stderr, "There should be a command or a subshell before pipe.\n");
-                    return 0;
+                    return parse_error(error, error_size, "There should be a command or a subshell before pipe.");
                 }
                 else {
                     is_free = 0;
                     is_waiting_command = 0;
                     is_reading_command = 1;
-                    buffer[buffer_index++] = *current_char;
+                    if ( !append_to_buffer(buffer, &buffer_index, current_char, 1, error, error_size) )
+                        return 0;
                 }
             }
             else if ( is_waiting_arg ) {
@@ -202,22 +565,21 @@ int parse_line(char *line, parsed_input *input) {
                     is_reading_arg = 1;
                 }
                 else if ( *current_char == '(' ) {
-                    fprintf(stderr, "There cannot be a subshell after a command. There should be a separator.\n");
-                    return 0;
+                    return parse_error(error, error_size, "There cannot be a subshell after a command. There should be a separator.");
                 }
-                else if ( *current_char == ';' ) {
+                else if ( is_sequential ) {
                     if ( input->separator == SEPARATOR_PARA ) {
-                        fprintf(stderr, "There cannot be a sequential separator after parallel.\n");
-                        return 0;
+                        return parse_error(error, error_size, "There cannot be a sequential separator after parallel.");
                     }
                     if (input->separator == SEPARATOR_PIPE) {
                         if (check_subshell(input)) {
-                            fprintf(stderr, "There cannot be a sequential separator after a subshell.\n");
-                            return 0;
+                            return parse_error(error, error_size, "There cannot be a sequential separator after a subshell.");
                         }
                         convert_to_pipeline(input);
                     }
                     input->separator = SEPARATOR_SEQ;
+                    input->links[input->num_inputs] = link;
+                    current_char += link == SEPARATOR_SEQ ? 0 : 1;
                     is_waiting_arg = 0;
                     is_waiting_command = 1;
 
@@ -225,13 +587,11 @@ int parse_line(char *line, parsed_input *input) {
                 }
                 else if ( *current_char == ',' ) {
                     if ( input->separator == SEPARATOR_SEQ ) {
-                        fprintf(stderr, "There cannot be a parallel separator after sequential.\n");
-                        return 0;
+                        return parse_error(error, error_size, "There cannot be a parallel separator after sequential.");
                     }
                     if (input->separator == SEPARATOR_PIPE) {
                         if (check_subshell(input)) {
-                            fprintf(stderr, "There cannot be a parallel separator after a subshell.\n");
-                            return 0;
+                            return parse_error(error, error_size, "There cannot be a parallel separator after a subshell.");
                         }
                         convert_to_pipeline(input);
                     }
@@ -269,7 +629,8 @@ int parse_line(char *line, parsed_input *input) {
                     is_free = 0;
                     is_waiting_arg = 0;
                     is_reading_arg = 1;
-                    buffer[buffer_index++] = *current_char;
+                    if ( !append_to_buffer(buffer, &buffer_index, current_char, 1, error, error_size) )
+                        return 0;
                 }
             }
             else if ( is_waiting_sep ) {
@@ -278,50 +639,69 @@ int parse_line(char *line, parsed_input *input) {
                     continue;
                 }
 
-                if ( *current_char == ';' ) {
-                    fprintf(stderr, "Subshells cannot be chained with a sequential operation.\n");
-                    return 0;
+                if ( is_sequential ) {
+                    if ( input->separator == SEPARATOR_PARA ) {
+                        return parse_error(error, error_size, "There cannot be a sequential separator after parallel.");
+                    }
+                    if ( input->separator == SEPARATOR_PIPE ) {
+                        return parse_error(error, error_size, "There cannot be a sequential separator after a subshell.");
+                    }
+                    input->separator = SEPARATOR_SEQ;
+                    input->links[input->num_inputs] = link;
+                    current_char += link == SEPARATOR_SEQ ? 0 : 1;
+                    is_waiting_sep = 0;
+                    is_waiting_command = 1;
                 }
                 else if ( *current_char == ',' ) {
-                    fprintf(stderr, "Subshells cannot be chained with a parallel operation.\n");
-                    return 0;
+                    if ( input->separator == SEPARATOR_SEQ ) {
+                        return parse_error(error, error_size, "There cannot be a parallel separator after sequential.");
+                    }
+                    if ( input->separator == SEPARATOR_PIPE ) {
+                        return parse_error(error, error_size, "There cannot be a parallel separator after a subshell.");
+                    }
+                    input->separator = SEPARATOR_PARA;
+                    is_waiting_sep = 0;
+                    is_waiting_command = 1;
                 }
                 else if ( *current_char == '|' ) {
+                    if ( input->separator == SEPARATOR_PARA || input->separator == SEPARATOR_SEQ ) {
+                        return parse_error(error, error_size, "Subshells cannot be piped inside a sequential or parallel operation.");
+                    }
                     input->separator = SEPARATOR_PIPE;
                     is_waiting_sep = 0;
                     is_waiting_command = 1;
                 }
                 else {
-                    fprintf(stderr, "Subshells should be followed by | or nothing.\n");
-                    return 0;
+                    return parse_error(error, error_size, "Subshells should be followed by | or nothing.");
                 }
             }
         }
         else if ( is_reading_command ) {
             if (isspace(*current_char)) {
                 buffer[buffer_index] = '\0';
-                write_buffer(input, buffer, 1, is_pipeline);
+                write_buffer(input, buffer, 1, is_pipeline, &word_flags);
                 buffer_index = 0;
                 is_reading_command = 0;
                 is_waiting_arg = 1;
                 is_free = 1;
             }
-            else if ( *current_char == ';' ) {
+            else if ( is_sequential ) {
                 if ( input->separator == SEPARATOR_PARA ) {
-                    fprintf(stderr, "There cannot be a sequential separator after parallel.\n");
-                    return 0;
+                    return parse_error(error, error_size, "There cannot be a sequential separator after parallel.");
                 }
                 if (input->separator == SEPARATOR_PIPE) {
                     if (check_subshell(input)) {
-                        fprintf(stderr, "There cannot be a sequential separator after a subshell.\n");
-                        return 0;
+                        return parse_error(error, error_size, "There cannot be a sequential separator after a subshell.");
                     }
-                    convert_to_pipeline(input);
                 }
                 buffer[buffer_index] = '\0';
-                write_buffer(input, buffer, 1, is_pipeline);
+                write_buffer(input, buffer, 1, is_pipeline, &word_flags);
                 buffer_index = 0;
+                if (input->separator == SEPARATOR_PIPE)
+                    convert_to_pipeline(input);
                 input->separator = SEPARATOR_SEQ;
+                input->links[input->num_inputs] = link;
+                current_char += link == SEPARATOR_SEQ ? 0 : 1;
                 is_reading_command = 0;
                 is_waiting_command = 1;
                 is_free = 1;
@@ -330,19 +710,18 @@ int parse_line(char *line, parsed_input *input) {
             }
             else if ( *current_char == ',' ) {
                 if ( input->separator == SEPARATOR_SEQ ) {
-                    fprintf(stderr, "There cannot be a parallel separator after sequential.\n");
-                    return 0;
+                    return parse_error(error, error_size, "There cannot be a parallel separator after sequential.");
                 }
                 if (input->separator == SEPARATOR_PIPE) {
                     if (check_subshell(input)) {
-                        fprintf(stderr, "There cannot be a parallel separator after a subshell.\n");
-                        return 0;
+                        return parse_error(error, error_size, "There cannot be a parallel separator after a subshell.");
                     }
-                    convert_to_pipeline(input);
                 }
                 buffer[buffer_index] = '\0';
-                write_buffer(input, buffer, 1, is_pipeline);
+                write_buffer(input, buffer, 1, is_pipeline, &word_flags);
                 buffer_index = 0;
+                if (input->separator == SEPARATOR_PIPE)
+                    convert_to_pipeline(input);
                 input->separator = SEPARATOR_PARA;
                 is_reading_command = 0;
                 is_waiting_command = 1;
@@ -353,7 +732,7 @@ int parse_line(char *line, parsed_input *input) {
             else if ( *current_char == '|' ) {
                 if (input->separator == SEPARATOR_PIPE) {
                     buffer[buffer_index] = '\0';
-                    write_buffer(input, buffer, 1, is_pipeline);
+                    write_buffer(input, buffer, 1, is_pipeline, &word_flags);
                     buffer_index = 0;
                     is_reading_command = 0;
                     is_waiting_command = 1;
@@ -361,7 +740,7 @@ int parse_line(char *line, parsed_input *input) {
                 }
                 else if ( input->separator == SEPARATOR_PARA || input->separator == SEPARATOR_SEQ ) {
                     buffer[buffer_index] = '\0';
-                    write_buffer(input, buffer, 1, is_pipeline);
+                    write_buffer(input, buffer, 1, is_pipeline, &word_flags);
                     buffer_index = 0;
                     int input_index = input->num_inputs-1;
                     if ( input->inputs[input_index].type == INPUT_TYPE_COMMAND ) {
@@ -376,7 +755,7 @@ int parse_line(char *line, parsed_input *input) {
                 }
                 else {
                     buffer[buffer_index] = '\0';
-                    write_buffer(input, buffer, 1, is_pipeline);
+                    write_buffer(input, buffer, 1, is_pipeline, &word_flags);
                     buffer_index = 0;
                     input->separator = SEPARATOR_PIPE;
                     is_reading_command = 0;
@@ -384,35 +763,48 @@ int parse_line(char *line, parsed_input *input) {
                     is_free = 1;
                 }
             }
+            else if ( *current_char == '(' && buffer_index > 0 && buffer[buffer_index-1] == '$' ) {
+                if ( !consume_substitution(&current_char, buffer, &buffer_index, error, error_size) )
+                    return 0;
+                word_flags |= WORD_SUBSTITUTED;
+                continue;
+            }
+            else if ( scan && *current_char != '&' && *current_char != '(' ) {
+                if ( !consume_run(scan, line, &current_char, SCAN_BIT(SCAN_SPACE) | SCAN_BIT(SCAN_SEP) | SCAN_BIT(SCAN_LPAREN),
+                                  buffer, &buffer_index, error, error_size) )
+                    return 0;
+                continue;
+            }
             else {
-                buffer[buffer_index++] = *current_char;
+                if ( !append_to_buffer(buffer, &buffer_index, current_char, 1, error, error_size) )
+                    return 0;
             }
         }
         else if ( is_reading_arg ) {
             if (isspace(*current_char)) {
                 buffer[buffer_index] = '\0';
-                write_buffer(input, buffer, 0, is_pipeline);
+                write_buffer(input, buffer, 0, is_pipeline, &word_flags);
                 buffer_index = 0;
                 is_reading_arg = 0;
                 is_waiting_arg = 1;
                 is_free = 1;
             }
-            else if ( *current_char == ';' ) {
+            else if ( is_sequential ) {
                 if ( input->separator == SEPARATOR_PARA ) {
-                    fprintf(stderr, "There cannot be a sequential separator after parallel.\n");
-                    return 0;
+                    return parse_error(error, error_size, "There cannot be a sequential separator after parallel.");
                 }
                 if (input->separator == SEPARATOR_PIPE) {
                     if (check_subshell(input)) {
-                        fprintf(stderr, "There cannot be a sequential separator after a subshell.\n");
-                        return 0;
+                        return parse_error(error, error_size, "There cannot be a sequential separator after a subshell.");
                     }
                     convert_to_pipeline(input);
                 }
                 buffer[buffer_index] = '\0';
-                write_buffer(input, buffer, 0, is_pipeline);
+                write_buffer(input, buffer, 0, is_pipeline, &word_flags);
                 buffer_index = 0;
                 input->separator = SEPARATOR_SEQ;
+                input->links[input->num_inputs] = link;
+                current_char += link == SEPARATOR_SEQ ? 0 : 1;
                 is_reading_arg = 0;
                 is_waiting_command = 1;
                 is_free = 1;
@@ -421,18 +813,16 @@ int parse_line(char *line, parsed_input *input) {
             }
             else if ( *current_char == ',' ) {
                 if ( input->separator == SEPARATOR_SEQ ) {
-                    fprintf(stderr, "There cannot be a parallel separator after sequential.\n");
-                    return 0;
+                    return parse_error(error, error_size, "There cannot be a parallel separator after sequential.");
                 }
                 if (input->separator == SEPARATOR_PIPE) {
                     if (check_subshell(input)) {
-                        fprintf(stderr, "There cannot be a parallel separator after a subshell.\n");
-                        return 0;
+                        return parse_error(error, error_size, "There cannot be a parallel separator after a subshell.");
                     }
                     convert_to_pipeline(input);
                 }
                 buffer[buffer_index] = '\0';
-                write_buffer(input, buffer, 0, is_pipeline);
+                write_buffer(input, buffer, 0, is_pipeline, &word_flags);
                 buffer_index = 0;
                 input->separator = SEPARATOR_PARA;
                 is_reading_arg = 0;
@@ -444,7 +834,7 @@ int parse_line(char *line, parsed_input *input) {
             else if ( *current_char == '|' ) {
                 if (input->separator == SEPARATOR_PIPE) {
                     buffer[buffer_index] = '\0';
-                    write_buffer(input, buffer, 0, is_pipeline);
+                    write_buffer(input, buffer, 0, is_pipeline, &word_flags);
                     buffer_index = 0;
                     is_reading_command = 0;
                     is_waiting_command = 1;
@@ -452,7 +842,7 @@ int parse_line(char *line, parsed_input *input) {
                 }
                 else if ( input->separator == SEPARATOR_PARA || input->separator == SEPARATOR_SEQ ) {
                     buffer[buffer_index] = '\0';
-                    write_buffer(input, buffer, 0, is_pipeline);
+                    write_buffer(input, buffer, 0, is_pipeline, &word_flags);
                     buffer_index = 0;
                     int input_index = input->num_inputs-1;
                     if ( input->inputs[input_index].type == INPUT_TYPE_COMMAND ) {
@@ -467,7 +857,7 @@ int parse_line(char *line, parsed_input *input) {
                 }
                 else {
                     buffer[buffer_index] = '\0';
-                    write_buffer(input, buffer, 1, is_pipeline);
+                    write_buffer(input, buffer, 0, is_pipeline, &word_flags);
                     buffer_index = 0;
                     input->separator = SEPARATOR_PIPE;
                     is_reading_arg = 0;
@@ -475,29 +865,75 @@ int parse_line(char *line, parsed_input *input) {
                     is_free = 1;
                 }
             }
+            else if ( *current_char == '(' && buffer_index > 0 && buffer[buffer_index-1] == '$' ) {
+                if ( !consume_substitution(&current_char, buffer, &buffer_index, error, error_size) )
+                    return 0;
+                word_flags |= WORD_SUBSTITUTED;
+                continue;
+            }
+            else if ( scan && *current_char != '&' && *current_char != '(' ) {
+                if ( !consume_run(scan, line, &current_char, SCAN_BIT(SCAN_SPACE) | SCAN_BIT(SCAN_SEP) | SCAN_BIT(SCAN_LPAREN),
+                                  buffer, &buffer_index, error, error_size) )
+                    return 0;
+                continue;
+            }
             else {
-                buffer[buffer_index++] = *current_char;
+                if ( !append_to_buffer(buffer, &buffer_index, current_char, 1, error, error_size) )
+                    return 0;
             }
         }
         current_char++;
     }
     if ( is_reading_command ) {
         buffer[buffer_index] = '\0';
-        write_buffer(input, buffer, 1, is_pipeline);
+        write_buffer(input, buffer, 1, is_pipeline, &word_flags);
     }
     else if ( is_reading_arg ) {
         buffer[buffer_index] = '\0';
-        write_buffer(input, buffer, 0, is_pipeline);
+        write_buffer(input, buffer, 0, is_pipeline, &word_flags);
     }
 
     return !is_waiting_command;
 }
 
+int parse_line_r(char *line, parsed_input *input, char *error, size_t error_size) {
+    if ( error != NULL && error_size > 0 )
+        error[0] = '\0';
+
+    line_scan scan;
+    if ( !scan_line(line, &scan) )
+        return parse_line_scanned(line, input, NULL, error, error_size);
+
+    int result = parse_line_scanned(line, input, &scan, error, error_size);
+    free(scan.storage);
+    return result;
+}
+
+int parse_line(char *line, parsed_input *input) {
+    char error[PARSE_ERROR_SIZE];
+    int result = parse_line_r(line, input, error, sizeof(error));
+    if ( error[0] )
+        fprintf(stderr, "%s\n", error);
+    return result;
+}
+
 void free_command(command *cmd) {
     if (cmd == NULL) return;
     // Free each argument in the command
     for (int i = 0; i < MAX_ARGS && cmd->args[i] != NULL; i++) {
-        free(cmd->args[i]); // Free each argument string
+        free_argument(cmd->args[i]); // Free each argument string
+    }
+    // Taken over from the args of a dropped cat, so it is accounted like one
+    if (cmd->input_file != NULL) {
+        free_argument(cmd->input_file);
+        cmd->input_file = NULL;
+    }
+    // The expanded argument vector is owned by the command once set, see command.argv
+    if (cmd->argv != NULL) {
+        for (int i = 0; cmd->argv[i] != NULL; i++)
+            free(cmd->argv[i]);
+        free(cmd->argv);
+        cmd->argv = NULL;
     }
     // No need to free cmd itself since it's part of an array or union
 }
@@ -515,6 +951,7 @@ void free_single_input(single_input *input) {
     if (input == NULL) return;
     switch (input->type) {
         case INPUT_TYPE_SUBSHELL:
+        case INPUT_TYPE_SHARD:
             // Since subshell uses a fixed-size char array, there's no dynamic memory to free
             break;
         case INPUT_TYPE_COMMAND:
@@ -545,6 +982,9 @@ void pretty_print(parsed_input *input) {
             case INPUT_TYPE_SUBSHELL:
                 printf("Subshell: %s\n", inp->data.subshell);
                 break;
+            case INPUT_TYPE_SHARD:
+                printf("Shard: %s\n", inp->data.subshell);
+                break;
             case INPUT_TYPE_COMMAND:
                 printf("Command: ");
                 for (char **arg = inp->data.cmd.args; *arg != NULL; arg++) {
@@ -565,6 +1005,14 @@ void pretty_print(parsed_input *input) {
                 break;
         }
         if (i < input->num_inputs - 1) {
+            if (input->separator == SEPARATOR_SEQ && input->links[i+1] == SEPARATOR_AND) {
+                printf("Followed by: SEPARATOR_AND\n");
+                continue;
+            }
+            if (input->separator == SEPARATOR_SEQ && input->links[i+1] == SEPARATOR_OR) {
+                printf("Followed by: SEPARATOR_OR\n");
+                continue;
+            }
             switch (input->separator) {
                 case SEPARATOR_PIPE: printf("Followed by: SEPARATOR_PIPE\n"); break;
                 case SEPARATOR_SEQ: printf("Followed by: SEPARATOR_SEQ\n"); break;
@@ -14,16 +14,26 @@ extern "C" {
 #define INPUT_BUFFER_SIZE 256
 #define MAX_ARGS 20
 #define MAX_INPUTS 10
+#define PARSE_ERROR_SIZE 128
 
 typedef enum {
-    INPUT_TYPE_NON, INPUT_TYPE_SUBSHELL, INPUT_TYPE_COMMAND, INPUT_TYPE_PIPELINE
+    INPUT_TYPE_NON, INPUT_TYPE_SUBSHELL, INPUT_TYPE_COMMAND, INPUT_TYPE_PIPELINE,
+    INPUT_TYPE_SHARD // [A , B]: like a subshell, but each input line goes to only one of the commands
 } SINGLE_INPUT_TYPE;
 typedef enum {
-    SEPARATOR_NONE, SEPARATOR_PIPE, SEPARATOR_SEQ, SEPARATOR_PARA
+    SEPARATOR_NONE, SEPARATOR_PIPE, SEPARATOR_SEQ, SEPARATOR_PARA, SEPARATOR_AND, SEPARATOR_OR
 } SEPARATOR;
 
+typedef enum {
+    SCAN_MODE_AUTO, SCAN_MODE_OFF, SCAN_MODE_SCALAR, SCAN_MODE_SSE2, SCAN_MODE_AVX2
+} SCAN_MODE;
+
 typedef struct {
     char *args[MAX_ARGS]; // Null-terminated arguments
+    unsigned int quoted; // Bit i is set when args[i] was written in quotes
+    unsigned int substituted; // Bit i is set when args[i] contains a $(...) command substitution
+    char **argv; // Null-terminated malloc'd arguments after expansion, NULL if nothing was expanded
+    char *input_file; // File to read stdin from, set by the optimizer when it drops a "cat file |" in front
 } command;
 
 typedef struct {
@@ -32,7 +42,7 @@ typedef struct {
 } pipeline;
 
 typedef union {
-    char subshell[INPUT_BUFFER_SIZE]; // Entire subshell string
+    char subshell[INPUT_BUFFER_SIZE]; // Entire subshell (or shard) string
     command cmd;                      // Single command
     pipeline pline;                   // Pipeline of commands
 } single_input_union;
@@ -45,6 +55,7 @@ typedef struct {
 typedef struct {
     single_input inputs[MAX_INPUTS]; // Array of inputs
     SEPARATOR separator; // Separators for the input
+    SEPARATOR links[MAX_INPUTS]; // In a sequence: SEPARATOR_SEQ, SEPARATOR_AND or SEPARATOR_OR before each input
     int num_inputs; // Number of inputs
 } parsed_input;
 
@@ -59,6 +70,32 @@ typedef struct {
  */
 int parse_line(char *line, parsed_input *input);
 
+/***
+ * Same as parse_line, but instead of printing parse errors to stderr it writes the message
+ * (without a trailing newline) into error, which is left empty on success.
+ * It keeps no state between calls, so different threads can parse different lines at the same time.
+ * @param line
+ * @param input
+ * @param error
+ * @param error_size
+ * @return
+ */
+int parse_line_r(char *line, parsed_input *input, char *error, size_t error_size);
+
+/***
+ * Selects how parse_line pre-scans the line for separators, quotes, parentheses and whitespace.
+ * SCAN_MODE_AUTO picks AVX2 or SSE2 at runtime depending on the CPU, SCAN_MODE_OFF goes char by char.
+ * Set it once before parsing, it is not meant to be changed while other threads are parsing.
+ * @param mode
+ */
+void parser_set_scan_mode(SCAN_MODE mode);
+
+/***
+ * Returns the pre-scan kernel parse_line will actually use on this machine.
+ * @return
+ */
+SCAN_MODE parser_active_scan_mode(void);
+
 /***
  * Frees the allocated characters inside the inputs to prevent memory leaks.
  * It is recommended that you use this function after executing the commands inside the parsed_input struct.
@@ -66,6 +103,21 @@ int parse_line(char *line, parsed_input *input);
  */
 void free_parsed_input(parsed_input *input);
 
+/***
+ * Frees the arguments of a single command, for code that takes commands out of a parsed_input.
+ * @param cmd
+ */
+void free_command(command *cmd);
+
+/***
+ * Reports the argument strings parse_line allocated that free_parsed_input hasn't released yet,
+ * and how many it allocated in total. Safe to call from a signal handler.
+ * @param live_bytes
+ * @param live_blocks
+ * @param total_allocations
+ */
+void parser_allocation_stats(long *live_bytes, long *live_blocks, long *total_allocations);
+
 /***
  * Prints the contents of the parsed_input struct nicely for checking.
  * You should look at how different inputs are stored to understand how parse_line works.
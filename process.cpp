@@ -0,0 +1,122 @@
+#include "process.h"
+#include "fdtable.h"
+#include <iostream>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+
+using namespace std;
+
+namespace {
+
+class PosixProcesses : public ProcessBackend {
+public:
+    pid_t start(const char*, const function<int()>& child) override{
+        auto pid = ::fork();
+        if(pid == 0){
+            // The error must not unwind into the parent's code, this process is a copy of it
+            int status;
+            try{
+                status = child();
+            } catch(const ShellError& error){
+                cout << "ASSERTION FAILED: " << error.what() << endl;
+                status = 255;
+            }
+            // Not exit(), which would also run the parent's atexit handlers and static destructors (a program
+            // embedding the library has its own), only this process' output is flushed
+            cout.flush();
+            fflush(stdout);
+            _exit(status);
+        }
+        return pid;
+    }
+
+    void exec(char* args[]) override{
+        execvp(args[0], args);
+    }
+
+    bool openPipe(int& readFd, int& writeFd) override{
+        return shellFds.openPipe(readFd, writeFd);
+    }
+
+    int openMemoryFile(const char* name) override{
+        return shellFds.openMemoryFile(name);
+    }
+
+    int close(int fd) override{
+        return shellFds.close(fd);
+    }
+
+    int dup2(int fd, int target) override{
+        return ::dup2(fd, target);
+    }
+
+    void closeInherited() override{
+        shellFds.closeAll();
+    }
+
+    int open(const char* path, int flags) override{
+        return ::open(path, flags);
+    }
+
+    ssize_t read(int fd, void* buffer, size_t size) override{
+        return ::read(fd, buffer, size);
+    }
+
+    pid_t wait(pid_t pid, int& status) override{
+        return waitpid(pid, &status, 0);
+    }
+
+    pid_t waitMeasured(pid_t pid, int& status, long long& peakKilobytes, bool block) override{
+        struct rusage usage;
+        auto reaped = wait4(pid, &status, block ? 0 : WNOHANG, &usage);
+#ifdef __APPLE__
+        // Bytes there
+        peakKilobytes = reaped > 0 ? usage.ru_maxrss / 1024 : 0;
+#else
+        peakKilobytes = reaped > 0 ? usage.ru_maxrss : 0;
+#endif
+        return reaped;
+    }
+
+    bool setProcessGroup(pid_t pid, pid_t group) override{
+        if(setpgid(pid, group) == 0){
+            return true;
+        }
+        // Refused once pid has exec'd, which is fine if it got there itself first
+        auto target = group != 0 ? group : (pid != 0 ? pid : getpid());
+        return getpgid(pid) == target;
+    }
+
+    void killGroup(pid_t group, int signal) override{
+        kill(-group, signal);
+    }
+
+    pid_t setForeground(pid_t group) override{
+        if(!isatty(STDIN_FILENO)){
+            return -1;
+        }
+        auto previous = tcgetpgrp(STDIN_FILENO);
+        // The shell isn't in the foreground group when it takes the terminal back, that would stop it
+        sigset_t blocked, saved;
+        sigemptyset(&blocked);
+        sigaddset(&blocked, SIGTTOU);
+        sigprocmask(SIG_BLOCK, &blocked, &saved);
+        tcsetpgrp(STDIN_FILENO, group);
+        sigprocmask(SIG_SETMASK, &saved, NULL);
+        return previous;
+    }
+};
+
+}
+
+ProcessBackend* posixProcesses(){
+    static PosixProcesses backend;
+    return &backend;
+}
+
+ProcessBackend* processes = posixProcesses();
@@ -0,0 +1,68 @@
+#ifndef PROCESS_H
+#define PROCESS_H
+
+#include <functional>
+#include <stdexcept>
+#include <sys/types.h>
+
+// An error the shell can't run a line past (a failed fork, pipe or dup, a line that doesn't parse). It unwinds
+// to whoever started the line: the shell reports it and exits, a child exits with status 255.
+struct ShellError : std::runtime_error {
+    explicit ShellError(const std::string& message) : std::runtime_error(message) {}
+};
+
+// Everything the executor asks of the OS to start, wire up and reap processes. The shell uses the POSIX
+// backend; the simulated one (simprocess.h) runs the same orchestration without spawning anything, so it
+// can be benchmarked and fuzzed.
+class ProcessBackend {
+public:
+    virtual ~ProcessBackend() {}
+
+    // Runs child in a new process and returns its pid, or -1 if none could be started. The child's return
+    // value is its exit status, unless it replaced itself with exec(). The child may run after start returns,
+    // so it should capture what it needs by value, the way fork copies it. A ShellError thrown by the child
+    // ends it with status 255. role names what the process is for ("pipeline stage", "subshell", ...), for
+    // backends that report on the processes.
+    virtual pid_t start(const char* role, const std::function<int()>& child) = 0;
+
+    // Replaces the current process with the command. Returns only if that failed.
+    virtual void exec(char* args[]) = 0;
+
+    // Both ends are close-on-exec. Returns false if the pipe couldn't be created.
+    virtual bool openPipe(int& readFd, int& writeFd) = 0;
+    // A file in memory the parent reads back once the writer is done, -1 if there is none (then use a pipe)
+    virtual int openMemoryFile(const char* name) = 0;
+    virtual int close(int fd) = 0;
+    virtual int dup2(int fd, int target) = 0;
+    // For children that keep running shell code: drops the pipe ends inherited from the parent
+    virtual void closeInherited() = 0;
+
+    virtual int open(const char* path, int flags) = 0;
+    virtual ssize_t read(int fd, void* buffer, size_t size) = 0;
+
+    // Waits for the child pid, for any child in group g if pid is -g, or for any child if pid is -1.
+    // Returns the pid reaped and sets its raw waitpid status, -1 with errno set if there was nothing to
+    // wait for.
+    virtual pid_t wait(pid_t pid, int& status) = 0;
+    // Like wait, and also sets the largest resident set the reaped process or its children had, in
+    // kilobytes, 0 where the backend can't tell. Without block, returns 0 if no child is done yet.
+    virtual pid_t waitMeasured(pid_t pid, int& status, long long& peakKilobytes, bool block){
+        peakKilobytes = 0;
+        return block ? wait(pid, status) : 0;
+    }
+
+    // Moves pid (0 for the current process) into group, or with group 0 makes it the leader of its own. Returns
+    // false if pid didn't end up there, as when no process is left in group.
+    virtual bool setProcessGroup(pid_t pid, pid_t group = 0) = 0;
+    virtual void killGroup(pid_t group, int signal) = 0;
+    // Gives the terminal on stdin to group, so its processes may read it. Returns the group that had it, -1 if
+    // stdin isn't a terminal.
+    virtual pid_t setForeground(pid_t group) = 0;
+};
+
+// The backend the executor uses, the POSIX one unless something else was installed
+extern ProcessBackend* processes;
+
+ProcessBackend* posixProcesses();
+
+#endif //PROCESS_H
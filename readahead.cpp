@@ -0,0 +1,479 @@
+#include "readahead.h"
+#include <algorithm>
+#include <fstream>
+#include <set>
+#include <sstream>
+#include <fcntl.h>
+#include <glob.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#ifdef __linux__
+#include <elf.h>
+#endif
+
+using namespace std;
+
+namespace {
+
+// How deep subshells inside subshells are looked into
+const int READAHEAD_MAX_DEPTH = 8;
+// Most of a dynamic string table that's read to find the library names
+const size_t READAHEAD_MAX_STRINGS = 1024 * 1024;
+// Most entries of a dynamic segment that are read, real ones have a few dozen
+const size_t READAHEAD_MAX_DYNAMIC = 4096;
+// Longest interpreter path that's read
+const size_t READAHEAD_MAX_INTERPRETER = 4096;
+
+bool isRegularFile(const string& path){
+    struct stat st;
+    return stat(path.c_str(), &st) == 0 && S_ISREG(st.st_mode);
+}
+
+string directoryOf(const string& path){
+    auto slash = path.rfind('/');
+    if(slash == string::npos){
+        return ".";
+    }
+    return slash == 0 ? "/" : path.substr(0, slash);
+}
+
+vector<string> splitPath(const string& text, const string& origin){
+    vector<string> directories;
+    stringstream entries(text);
+    string directory;
+    while(getline(entries, directory, ':')){
+        for(auto name : {"$ORIGIN", "${ORIGIN}"}){
+            auto found = directory.find(name);
+            if(found != string::npos){
+                directory.replace(found, strlen(name), origin);
+            }
+        }
+        directories.push_back(directory.empty() ? "." : directory);
+    }
+    return directories;
+}
+
+// Whether every page of the file is in the page cache
+bool isCached(const string& path){
+    auto fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if(fd < 0){
+        return false;
+    }
+    struct stat st;
+    if(fstat(fd, &st) != 0 || st.st_size == 0){
+        close(fd);
+        return st.st_size == 0;
+    }
+    auto size = (size_t)st.st_size;
+    auto mapping = mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if(mapping == MAP_FAILED){
+        return false;
+    }
+
+    auto pageSize = (size_t)sysconf(_SC_PAGESIZE);
+#ifdef __APPLE__
+    vector<char> pages((size + pageSize - 1) / pageSize);
+    auto known = mincore((caddr_t)mapping, size, pages.data()) == 0;
+#else
+    vector<unsigned char> pages((size + pageSize - 1) / pageSize);
+    auto known = mincore(mapping, size, pages.data()) == 0;
+#endif
+    munmap(mapping, size);
+    if(!known){
+        return false;
+    }
+    for(auto page : pages){
+        if(!(page & 1)){
+            return false;
+        }
+    }
+    return true;
+}
+
+// Asks the kernel to start reading the whole file into the page cache, without waiting for it
+void warm(const string& path){
+    auto fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if(fd < 0){
+        return;
+    }
+#if defined(POSIX_FADV_WILLNEED)
+    posix_fadvise(fd, 0, 0, POSIX_FADV_WILLNEED);
+#elif defined(F_RDADVISE)
+    struct stat st;
+    if(fstat(fd, &st) == 0){
+        struct radvisory advice;
+        advice.ra_offset = 0;
+        advice.ra_count = (int)st.st_size;
+        fcntl(fd, F_RDADVISE, &advice);
+    }
+#endif
+    close(fd);
+}
+
+// What the loader needs besides the file itself
+struct ElfInfo {
+    int elfClass = -1;
+    string interpreter;
+    vector<string> needed;
+    string runPath;
+    string rPath;
+};
+
+#ifdef __linux__
+bool readAt(int fd, void* buffer, size_t size, off_t offset){
+    return pread(fd, buffer, size, offset) == (ssize_t)size;
+}
+
+// Whether size bytes at offset are all inside a file of fileSize bytes. Sizes come from the file itself,
+// nothing is allocated for them before this says they can be there.
+bool inFile(unsigned long long offset, unsigned long long size, unsigned long long fileSize){
+    return offset <= fileSize && size <= fileSize - offset;
+}
+
+template<class Ehdr, class Phdr, class Dyn>
+bool readElfAs(int fd, unsigned long long fileSize, ElfInfo& info){
+    Ehdr header;
+    if(!readAt(fd, &header, sizeof(header), 0) || header.e_phentsize != sizeof(Phdr) || header.e_phnum == 0 ||
+       !inFile(header.e_phoff, (unsigned long long)header.e_phnum * sizeof(Phdr), fileSize)){
+        return false;
+    }
+    vector<Phdr> segments(header.e_phnum);
+    if(!readAt(fd, segments.data(), segments.size() * sizeof(Phdr), header.e_phoff)){
+        return false;
+    }
+
+    vector<Dyn> dynamic;
+    for(auto& segment : segments){
+        if(!inFile(segment.p_offset, segment.p_filesz, fileSize)){
+            continue;
+        }
+        if(segment.p_type == PT_INTERP && segment.p_filesz > 1 && segment.p_filesz < READAHEAD_MAX_INTERPRETER){
+            string interpreter(segment.p_filesz, '\0');
+            if(readAt(fd, &interpreter[0], segment.p_filesz, segment.p_offset)){
+                info.interpreter = interpreter.c_str();
+            }
+        } else if(segment.p_type == PT_DYNAMIC && segment.p_filesz >= sizeof(Dyn)){
+            dynamic.resize(min<unsigned long long>(segment.p_filesz / sizeof(Dyn), READAHEAD_MAX_DYNAMIC));
+            if(!readAt(fd, dynamic.data(), dynamic.size() * sizeof(Dyn), segment.p_offset)){
+                dynamic.clear();
+            }
+        }
+    }
+
+    unsigned long long stringsAddress = 0, stringsSize = 0;
+    vector<unsigned long long> needed;
+    long long runPath = -1, rPath = -1;
+    for(auto& entry : dynamic){
+        if(entry.d_tag == DT_NULL){
+            break;
+        }
+        switch(entry.d_tag){
+            case DT_NEEDED: needed.push_back(entry.d_un.d_val); break;
+            case DT_STRTAB: stringsAddress = entry.d_un.d_ptr; break;
+            case DT_STRSZ: stringsSize = entry.d_un.d_val; break;
+            case DT_RUNPATH: runPath = entry.d_un.d_val; break;
+            case DT_RPATH: rPath = entry.d_un.d_val; break;
+        }
+    }
+    if(stringsAddress == 0 || stringsSize == 0 || stringsSize > READAHEAD_MAX_STRINGS){
+        return true;
+    }
+
+    // The string table is given by address, the segment loaded there says where it is in the file
+    for(auto& segment : segments){
+        if(segment.p_type != PT_LOAD || stringsAddress < segment.p_vaddr ||
+           stringsAddress - segment.p_vaddr > segment.p_filesz ||
+           stringsSize > segment.p_filesz - (stringsAddress - segment.p_vaddr)){
+            continue;
+        }
+        auto stringsOffset = segment.p_offset + (stringsAddress - segment.p_vaddr);
+        if(!inFile(stringsOffset, stringsSize, fileSize)){
+            return true;
+        }
+        string strings(stringsSize, '\0');
+        if(!readAt(fd, &strings[0], stringsSize, stringsOffset)){
+            return true;
+        }
+        auto at = [&strings](unsigned long long offset){
+            return offset < strings.size() ? string(strings.c_str() + offset) : string();
+        };
+        for(auto offset : needed){
+            info.needed.push_back(at(offset));
+        }
+        info.runPath = runPath >= 0 ? at(runPath) : "";
+        info.rPath = rPath >= 0 ? at(rPath) : "";
+        break;
+    }
+    return true;
+}
+#endif
+
+// False if path isn't an ELF file for this machine's byte order
+bool readElf(const string& path, ElfInfo& info){
+#ifdef __linux__
+    auto fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if(fd < 0){
+        return false;
+    }
+    struct stat st;
+    unsigned char ident[EI_NIDENT];
+    auto isElf = fstat(fd, &st) == 0 && readAt(fd, ident, sizeof(ident), 0) && memcmp(ident, ELFMAG, SELFMAG) == 0;
+    auto fileSize = isElf ? (unsigned long long)st.st_size : 0;
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    isElf = isElf && ident[EI_DATA] == ELFDATA2LSB;
+#else
+    isElf = isElf && ident[EI_DATA] == ELFDATA2MSB;
+#endif
+    auto read = false;
+    if(isElf && ident[EI_CLASS] == ELFCLASS64){
+        read = readElfAs<Elf64_Ehdr, Elf64_Phdr, Elf64_Dyn>(fd, fileSize, info);
+    } else if(isElf && ident[EI_CLASS] == ELFCLASS32){
+        read = readElfAs<Elf32_Ehdr, Elf32_Phdr, Elf32_Dyn>(fd, fileSize, info);
+    }
+    info.elfClass = read ? ident[EI_CLASS] : -1;
+    close(fd);
+    return read;
+#else
+    (void)path;
+    (void)info;
+    return false;
+#endif
+}
+
+int elfClassOf(const string& path){
+    ElfInfo info;
+    return readElf(path, info) ? info.elfClass : -1;
+}
+
+// The program a script's #! line names, empty if it has none
+string scriptInterpreter(const string& path){
+    ifstream file(path);
+    string line;
+    if(!getline(file, line) || line.compare(0, 2, "#!") != 0){
+        return "";
+    }
+    istringstream words(line.substr(2));
+    string interpreter;
+    words >> interpreter;
+    return interpreter;
+}
+
+void readLoaderConfig(const string& path, vector<string>& directories, int depth){
+    ifstream config(path);
+    string line;
+    while(depth < READAHEAD_MAX_DEPTH && getline(config, line)){
+        auto comment = line.find('#');
+        if(comment != string::npos){
+            line.erase(comment);
+        }
+        istringstream words(line);
+        string word;
+        if(!(words >> word)){
+            continue;
+        }
+        if(word != "include"){
+            directories.push_back(word);
+            continue;
+        }
+        string pattern;
+        while(words >> pattern){
+            if(pattern[0] != '/'){
+                pattern = directoryOf(path) + "/" + pattern;
+            }
+            glob_t matches;
+            if(glob(pattern.c_str(), 0, NULL, &matches) == 0){
+                for(size_t i = 0; i < matches.gl_pathc; i++){
+                    readLoaderConfig(matches.gl_pathv[i], directories, depth + 1);
+                }
+            }
+            globfree(&matches);
+        }
+    }
+}
+
+}
+
+vector<string> ExecutableReadahead::prefetch(parsed_input* input){
+    lines++;
+    vector<string> files;
+    addInput(input, 0, files);
+
+    vector<string> warmed;
+    set<string> seen;
+    for(auto& file : files){
+        if(!seen.insert(file).second){
+            continue;
+        }
+        if(isCached(file)){
+            alreadyCached++;
+            continue;
+        }
+        warm(file);
+        readAhead++;
+        warmed.push_back(file);
+    }
+    return warmed;
+}
+
+void ExecutableReadahead::arrived(const vector<string>& files){
+    for(auto& file : files){
+        if(isCached(file)){
+            hits++;
+        } else{
+            misses++;
+        }
+    }
+}
+
+void ExecutableReadahead::report(size_t lookahead) const{
+    fprintf(stderr, "readahead: %ld lines, %zu ahead: %ld commands found, %ld not found\n", lines.load(), lookahead,
+            resolved.load(), notFound.load());
+    fprintf(stderr, "  %ld files already cached, %ld read ahead: %ld hits, %ld misses\n", alreadyCached.load(),
+            readAhead.load(), hits.load(), misses.load());
+}
+
+void ExecutableReadahead::addInput(parsed_input* input, int depth, vector<string>& files){
+    for(int i = 0; i < input->num_inputs; i++){
+        auto& single = input->inputs[i];
+        if(single.type == INPUT_TYPE_COMMAND){
+            if(!(single.data.cmd.substituted & 1)){
+                addCommand(single.data.cmd.args[0], files);
+            }
+        } else if(single.type == INPUT_TYPE_PIPELINE){
+            for(int j = 0; j < single.data.pline.num_commands; j++){
+                if(!(single.data.pline.commands[j].substituted & 1)){
+                    addCommand(single.data.pline.commands[j].args[0], files);
+                }
+            }
+        } else if((single.type == INPUT_TYPE_SUBSHELL || single.type == INPUT_TYPE_SHARD) &&
+                  depth < READAHEAD_MAX_DEPTH){
+            vector<char> text(single.data.subshell, single.data.subshell + strlen(single.data.subshell) + 1);
+            parsed_input inner;
+            char error[PARSE_ERROR_SIZE];
+            if(parse_line_r(text.data(), &inner, error, sizeof(error))){
+                addInput(&inner, depth + 1, files);
+            }
+            free_parsed_input(&inner);
+        }
+    }
+}
+
+void ExecutableReadahead::addCommand(const char* name, vector<string>& files){
+    // Wildcards and variables aren't expanded yet, what they run isn't known
+    if(name == NULL || strpbrk(name, "*?[$") != NULL){
+        return;
+    }
+    auto path = resolveCommand(name);
+    if(path.empty()){
+        notFound++;
+        return;
+    }
+    resolved++;
+    auto& closure = dependencies(path);
+    files.insert(files.end(), closure.begin(), closure.end());
+}
+
+// Where execvp would find the command, empty if it wouldn't
+string ExecutableReadahead::resolveCommand(const string& name){
+    auto known = commands.find(name);
+    if(known != commands.end()){
+        return known->second;
+    }
+
+    string found;
+    if(name.find('/') != string::npos){
+        found = isRegularFile(name) && access(name.c_str(), X_OK) == 0 ? name : "";
+    } else{
+        auto path = getenv("PATH");
+        for(auto& directory : splitPath(path != NULL ? path : "/bin:/usr/bin", ".")){
+            auto candidate = directory + "/" + name;
+            if(isRegularFile(candidate) && access(candidate.c_str(), X_OK) == 0){
+                found = candidate;
+                break;
+            }
+        }
+    }
+    commands[name] = found;
+    return found;
+}
+
+// The program and everything the loader maps for it, found the way ld.so looks: RPATH (when there's no
+// RUNPATH), LD_LIBRARY_PATH, RUNPATH, ld.so.conf, then the default directories
+const vector<string>& ExecutableReadahead::dependencies(const string& program){
+    auto known = closures.find(program);
+    if(known != closures.end()){
+        return known->second;
+    }
+
+    if(libraryDirectories.empty()){
+        readLoaderConfig("/etc/ld.so.conf", libraryDirectories, 0);
+        for(auto directory : {"/lib64", "/usr/lib64", "/lib", "/usr/lib"}){
+            libraryDirectories.push_back(directory);
+        }
+    }
+
+    auto& closure = closures[program];
+    set<string> seen;
+    closure.push_back(program);
+    seen.insert(program);
+
+    auto interpreter = scriptInterpreter(program);
+    if(!interpreter.empty() && isRegularFile(interpreter)){
+        closure.push_back(interpreter);
+        seen.insert(interpreter);
+    }
+
+    // Grows while it's walked, every file's libraries are added after it
+    for(size_t i = 0; i < closure.size(); i++){
+        auto file = closure[i];
+        ElfInfo info;
+        if(!readElf(file, info)){
+            continue;
+        }
+        if(!info.interpreter.empty() && seen.insert(info.interpreter).second && isRegularFile(info.interpreter)){
+            closure.push_back(info.interpreter);
+        }
+
+        auto origin = directoryOf(file);
+        vector<string> directories;
+        if(info.runPath.empty()){
+            directories = splitPath(info.rPath, origin);
+        }
+        auto libraryPath = getenv("LD_LIBRARY_PATH");
+        if(libraryPath != NULL && libraryPath[0] != '\0'){
+            auto extra = splitPath(libraryPath, origin);
+            directories.insert(directories.end(), extra.begin(), extra.end());
+        }
+        if(!info.runPath.empty()){
+            auto extra = splitPath(info.runPath, origin);
+            directories.insert(directories.end(), extra.begin(), extra.end());
+        }
+        directories.insert(directories.end(), libraryDirectories.begin(), libraryDirectories.end());
+
+        for(auto& name : info.needed){
+            if(name.empty()){
+                continue;
+            }
+            string library;
+            if(name.find('/') != string::npos){
+                library = isRegularFile(name) ? name : "";
+            }
+            for(size_t j = 0; library.empty() && name.find('/') == string::npos && j < directories.size(); j++){
+                auto candidate = directories[j] + "/" + name;
+                // A library of the other word size can sit in a directory searched first
+                if(isRegularFile(candidate) && elfClassOf(candidate) == info.elfClass){
+                    library = candidate;
+                }
+            }
+            if(!library.empty() && seen.insert(library).second){
+                closure.push_back(library);
+            }
+        }
+    }
+    return closure;
+}
@@ -0,0 +1,49 @@
+#ifndef READAHEAD_H
+#define READAHEAD_H
+
+#include <atomic>
+#include <map>
+#include <string>
+#include <vector>
+#include "parser.h"
+
+// --readahead: in script mode, the front end warms the page cache for the lines it has parsed ahead (up to
+// --lookahead of them), so the programs they run don't start on cold page faults. Each command is looked up
+// through PATH like execvp does, and the program, its ELF interpreter and its DT_NEEDED libraries (with
+// theirs, through RUNPATH, LD_LIBRARY_PATH, ld.so.conf and the usual directories) that aren't cached yet
+// are handed to posix_fadvise(WILLNEED).
+//
+// When a line comes up to run, the files read ahead for it are checked again with mincore: a hit is one
+// that's all in the cache by then, a miss one that isn't yet, which says the lookahead is too short.
+class ExecutableReadahead {
+public:
+    // On the front end thread, for a line just parsed. Returns the files read ahead for it.
+    std::vector<std::string> prefetch(parsed_input* input);
+
+    // On the executor, just before the line that prefetch returned files for runs
+    void arrived(const std::vector<std::string>& files);
+
+    // The counts so far, on stderr
+    void report(size_t lookahead) const;
+
+private:
+    void addCommand(const char* name, std::vector<std::string>& files);
+    void addInput(parsed_input* input, int depth, std::vector<std::string>& files);
+    std::string resolveCommand(const std::string& name);
+    const std::vector<std::string>& dependencies(const std::string& path);
+
+    // Only the front end thread uses these
+    std::map<std::string, std::string> commands;
+    std::map<std::string, std::vector<std::string>> closures;
+    std::vector<std::string> libraryDirectories;
+
+    std::atomic<long> lines{0};
+    std::atomic<long> resolved{0};
+    std::atomic<long> notFound{0};
+    std::atomic<long> alreadyCached{0};
+    std::atomic<long> readAhead{0};
+    std::atomic<long> hits{0};
+    std::atomic<long> misses{0};
+};
+
+#endif //READAHEAD_H
@@ -0,0 +1,211 @@
+#include "shard.h"
+#include "fileinfo.h"
+#include <errno.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+
+using namespace std;
+
+// Lines for one worker are collected up to this much before they are written
+const size_t SHARD_FLUSH_SIZE = 64 * 1024;
+// The least-loaded policy looks at the pipes again after handing out this much
+const size_t LEAST_LOADED_BATCH = 4 * 1024;
+
+char* parseShardSpec(char* text, ShardSpec& spec){
+    spec = ShardSpec();
+
+    auto start = text;
+    while(isspace((unsigned char)*start)){
+        start++;
+    }
+    auto end = start;
+    while(isalnum((unsigned char)*end) || *end == '='){
+        end++;
+    }
+    // No prefix, all of it is commands
+    if(*end != ':'){
+        return text;
+    }
+
+    string name(start, end);
+    if(name == "rr"){
+        spec.policy = ShardPolicy::RoundRobin;
+    } else if(name == "least"){
+        spec.policy = ShardPolicy::LeastLoaded;
+    } else if(name == "hash"){
+        spec.policy = ShardPolicy::Hash;
+    } else if(name.compare(0, 5, "hash=") == 0 && name.size() > 5){
+        char* fieldEnd;
+        auto field = strtol(name.c_str() + 5, &fieldEnd, 10);
+        if(*fieldEnd != '\0' || field < 1){
+            return NULL;
+        }
+        spec.policy = ShardPolicy::Hash;
+        spec.keyField = (int)field;
+    } else{
+        return NULL;
+    }
+
+    return end + 1;
+}
+
+ShardDistributor::ShardDistributor(const ShardSpec& spec, const vector<int>& workerFds)
+    : spec(spec), fds(workerFds), pending(workerFds.size()), lineCounts(workerFds.size(), 0) {
+}
+
+// FNV-1a of the key field, a line with fewer fields hashes as an empty key
+static size_t hashKey(const char* line, size_t size, int field){
+    auto begin = line;
+    auto end = line + size;
+
+    if(field > 0){
+        for(int i = 1; ; i++){
+            while(begin < end && isspace((unsigned char)*begin)){
+                begin++;
+            }
+            auto fieldEnd = begin;
+            while(fieldEnd < end && !isspace((unsigned char)*fieldEnd)){
+                fieldEnd++;
+            }
+            if(i == field){
+                end = fieldEnd;
+                break;
+            }
+            begin = fieldEnd;
+        }
+    } else if(end > begin && end[-1] == '\n'){
+        end--;
+    }
+
+    return (size_t)hashBytes(begin, end - begin);
+}
+
+// Ties go round robin, starting after the last pick, so idle workers all get batches
+size_t ShardDistributor::emptiestWorker(){
+    size_t best = 0;
+    int bestQueued = 0;
+    for(size_t n = 0; n < fds.size(); n++){
+        auto i = (batchWorker + 1 + n) % fds.size();
+        int queued = 0;
+        if(ioctl(fds[i], FIONREAD, &queued) < 0){
+            queued = 0;
+        }
+        if(n == 0 || queued < bestQueued){
+            best = i;
+            bestQueued = queued;
+        }
+    }
+    return best;
+}
+
+size_t ShardDistributor::pickWorker(const char* line, size_t size){
+    switch(spec.policy){
+    case ShardPolicy::Hash:
+        return hashKey(line, size, spec.keyField) % fds.size();
+    case ShardPolicy::LeastLoaded:
+        // Pipe fill is only worth asking about once a batch is out, a syscall per line would cost more than it saves
+        if(!inBatch || batchBytes >= LEAST_LOADED_BATCH){
+            if(inBatch && !flush(batchWorker)){
+                return fds.size();
+            }
+            batchWorker = emptiestWorker();
+            batchBytes = 0;
+            inBatch = true;
+        }
+        batchBytes += size;
+        return batchWorker;
+    case ShardPolicy::RoundRobin:
+    default:
+        return nextWorker++ % fds.size();
+    }
+}
+
+bool ShardDistributor::send(const char* line, size_t size){
+    auto worker = pickWorker(line, size);
+    if(worker >= fds.size()){
+        return false;
+    }
+
+    pending[worker].append(line, size);
+    lineCounts[worker]++;
+    if(pending[worker].size() >= SHARD_FLUSH_SIZE){
+        return flush(worker);
+    }
+    return true;
+}
+
+bool ShardDistributor::flush(size_t worker){
+    auto& buffer = pending[worker];
+    size_t written = 0;
+    while(written < buffer.size()){
+        auto count = write(fds[worker], buffer.data() + written, buffer.size() - written);
+        if(count < 0 && errno == EINTR){
+            continue;
+        }
+        if(count < 0){
+            return false;
+        }
+        written += count;
+    }
+    buffer.clear();
+    return true;
+}
+
+bool ShardDistributor::flushAll(){
+    for(size_t i = 0; i < fds.size(); i++){
+        if(!flush(i)){
+            return false;
+        }
+    }
+    return true;
+}
+
+bool ShardDistributor::feed(const char* data, size_t size){
+    auto end = data + size;
+    auto position = data;
+
+    // Finish the line the last block ended in
+    if(!partial.empty()){
+        auto newline = (const char*)memchr(position, '\n', end - position);
+        if(newline == NULL){
+            partial.append(position, end - position);
+            return true;
+        }
+        partial.append(position, newline + 1 - position);
+        position = newline + 1;
+        if(!send(partial.data(), partial.size())){
+            return false;
+        }
+        partial.clear();
+    }
+
+    while(position < end){
+        auto newline = (const char*)memchr(position, '\n', end - position);
+        if(newline == NULL){
+            partial.assign(position, end - position);
+            break;
+        }
+        if(!send(position, newline + 1 - position)){
+            return false;
+        }
+        position = newline + 1;
+    }
+
+    // Workers see lines as soon as a block is handed out, not only once 64K have piled up
+    return flushAll();
+}
+
+bool ShardDistributor::finish(){
+    if(!partial.empty()){
+        partial.push_back('\n');
+        if(!send(partial.data(), partial.size())){
+            return false;
+        }
+        partial.clear();
+    }
+    return flushAll();
+}
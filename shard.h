@@ -0,0 +1,56 @@
+#ifndef SHARD_H
+#define SHARD_H
+
+#include <string>
+#include <vector>
+#include <stddef.h>
+
+// How a shard ([A , B , C]) picks the worker for each input line
+enum class ShardPolicy {
+    RoundRobin,  // rr: line i goes to worker i % n
+    LeastLoaded, // least: small batches of lines go to the worker whose pipe holds the fewest unread bytes
+    Hash         // hash: or hash=N: lines with the same key (whole line, or its Nth field) go to the same worker
+};
+
+struct ShardSpec {
+    ShardPolicy policy = ShardPolicy::RoundRobin;
+    int keyField = 0; // 1-based whitespace-separated field the hash policy uses, 0 for the whole line
+};
+
+// Reads the optional policy prefix ("rr:", "least:", "hash:", "hash=N:") off a shard's text.
+// Returns a pointer to the commands after it, or NULL if the prefix names no policy.
+char* parseShardSpec(char* text, ShardSpec& spec);
+
+// Splits a byte stream into lines and writes each line, whole, to exactly one worker pipe.
+// Writes block, so a slow worker holds back the producer just like a slow pipeline stage would.
+class ShardDistributor {
+public:
+    ShardDistributor(const ShardSpec& spec, const std::vector<int>& workerFds);
+
+    // Sends the complete lines in data, a trailing partial line waits for the rest. False if a write failed.
+    bool feed(const char* data, size_t size);
+
+    // Sends the last line (with a newline if it had none) and anything still buffered
+    bool finish();
+
+    const std::vector<long long>& linesPerWorker() const { return lineCounts; }
+
+private:
+    size_t pickWorker(const char* line, size_t size);
+    size_t emptiestWorker();
+    bool send(const char* line, size_t size);
+    bool flush(size_t worker);
+    bool flushAll();
+
+    ShardSpec spec;
+    std::vector<int> fds;
+    std::vector<std::string> pending;
+    std::vector<long long> lineCounts;
+    std::string partial;
+    size_t nextWorker = 0;
+    size_t batchWorker = 0;
+    size_t batchBytes = 0;
+    bool inBatch = false;
+};
+
+#endif //SHARD_H
@@ -0,0 +1,566 @@
+#include "simprocess.h"
+#include <errno.h>
+#include <string.h>
+#include <signal.h>
+
+using namespace std;
+
+namespace {
+
+// Thrown by exec() to leave the shell code of a simulated child, start() turns it into a running command
+struct SimulatedExec {};
+
+const pid_t ROOT_PID = 1;
+
+// The raw statuses waitpid reports on Linux and the BSDs
+int exitedWith(int code){
+    return (code & 0xff) << 8;
+}
+
+}
+
+SimulatedProcesses::SimulatedProcesses(unsigned seed, int failurePercent)
+    : random(seed), randomize(seed != 0), failurePercent(failurePercent){
+    unique_ptr<Process> root(new Process);
+    root->pid = ROOT_PID;
+    root->group = ROOT_PID;
+    root->isShell = true;
+    root->fds[0] = {-1, false, -1};
+    root->fds[1] = {-1, true, -1};
+    root->fds[2] = {-1, true, -1};
+    table[ROOT_PID] = move(root);
+}
+
+SimulatedProcesses::~SimulatedProcesses(){
+    for(auto& entry : table){
+        auto& thread = entry.second->thread;
+        if(thread.joinable()){
+            if(entry.second->exited || entry.second->isExec){
+                thread.join();
+            } else{
+                thread.detach();
+            }
+        }
+    }
+}
+
+SimulatedProcesses::Process& SimulatedProcesses::self(){
+    return *table[running];
+}
+
+SimulatedProcesses::Process* SimulatedProcesses::find(pid_t pid){
+    auto it = table.find(pid);
+    return it == table.end() ? NULL : it->second.get();
+}
+
+int SimulatedProcesses::lowestFreeFd(const Process& process) const{
+    int fd = 0;
+    while(process.fds.count(fd)){
+        fd++;
+    }
+    return fd;
+}
+
+void SimulatedProcesses::retain(const End& end){
+    if(end.pipe >= 0){
+        (end.isWrite ? pipes[end.pipe].writers : pipes[end.pipe].readers)++;
+    }
+}
+
+void SimulatedProcesses::release(const End& end){
+    if(end.pipe >= 0){
+        (end.isWrite ? pipes[end.pipe].writers : pipes[end.pipe].readers)--;
+    }
+}
+
+void SimulatedProcesses::releaseAll(Process& process){
+    for(auto& fd : process.fds){
+        release(fd.second);
+    }
+    process.fds.clear();
+}
+
+void SimulatedProcesses::exitProcess(Process& process, int status){
+    process.exited = true;
+    process.status = status;
+    process.canRun = nullptr;
+    releaseAll(process);
+}
+
+string SimulatedProcesses::describeFd(const Process& process, int fd) const{
+    auto it = process.fds.find(fd);
+    if(it == process.fds.end()){
+        return "closed";
+    }
+    if(it->second.pipe >= 0){
+        return "pipe " + to_string(it->second.pipe + 1);
+    }
+    if(it->second.file >= 0){
+        return "file " + files[it->second.file];
+    }
+    return "inherited";
+}
+
+void SimulatedProcesses::traceProcess(const Process& process){
+    if(tracing){
+        traceList.push_back({process.pid, process.parent, process.role, process.commandLine,
+                             describeFd(process, 0), describeFd(process, 1)});
+    }
+}
+
+string SimulatedProcesses::describe(const Process& process) const{
+    return "pid " + to_string(process.pid) + " (" + (process.isExec ? process.command : string("shell")) + ")";
+}
+
+void SimulatedProcesses::problem(const string& text){
+    problemList.push_back(text);
+}
+
+// An exec'd command is done once nobody can write to its stdin any more
+bool SimulatedProcesses::isFinishable(const Process& process) const{
+    if(!process.isExec || process.exited){
+        return false;
+    }
+    auto in = process.fds.find(0);
+    return in == process.fds.end() || in->second.pipe < 0 || pipes[in->second.pipe].writers == 0;
+}
+
+bool SimulatedProcesses::isReady(const Process& process) const{
+    return process.isShell && !process.exited && (process.forced || !process.canRun || process.canRun());
+}
+
+// Nothing can run: report who is stuck and get the line moving again
+void SimulatedProcesses::breakDeadlock(){
+    counters.deadlocks++;
+
+    string stuck;
+    for(auto& entry : table){
+        auto& process = *entry.second;
+        if(!process.exited && (process.isExec || !isReady(process))){
+            stuck += (stuck.empty() ? "" : ", ") + describe(process);
+        }
+    }
+    problem("deadlock: " + stuck);
+
+    // Kill the commands first, that's what a user at the terminal would do
+    auto killed = false;
+    for(auto& entry : table){
+        auto& process = *entry.second;
+        if(process.isExec && !process.exited){
+            exitProcess(process, SIGKILL);
+            killed = true;
+        }
+    }
+    if(killed){
+        return;
+    }
+
+    // Shells waiting on each other: fail the innermost one's blocking call
+    for(auto it = table.rbegin(); it != table.rend(); ++it){
+        auto& process = *it->second;
+        if(process.isShell && !process.exited && !isReady(process)){
+            process.forced = true;
+            return;
+        }
+    }
+}
+
+// Hands the turn to the next process that can run, finishing the commands that can finish on the way.
+// Returns false right away if the caller is done (exited or exec'd), otherwise once it has the turn again.
+// With mayStay the caller itself may be picked, then nothing switches.
+bool SimulatedProcesses::switchAway(unique_lock<mutex>& lock, bool mayStay){
+    while(true){
+        vector<Process*> candidates;
+        for(auto& entry : table){
+            auto& process = *entry.second;
+            if(isFinishable(process) || (isReady(process) && (mayStay || process.pid != running))){
+                candidates.push_back(&process);
+            }
+        }
+        if(candidates.empty()){
+            breakDeadlock();
+            continue;
+        }
+
+        auto next = candidates[randomize ? random() % candidates.size() : 0];
+        if(next->isExec){
+            exitProcess(*next, exitedWith(next->status));
+            continue;
+        }
+        if(next->pid == running){
+            return true;
+        }
+
+        auto done = !self().isShell || self().exited;
+        handOver(lock, next->pid, !done);
+        return !done;
+    }
+}
+
+// Gives the turn to next, and with waitForTurn sleeps until the caller gets it back
+void SimulatedProcesses::handOver(unique_lock<mutex>& lock, pid_t next, bool waitForTurn){
+    auto& me = self();
+    running = next;
+    counters.switches++;
+    table[next]->turn.notify_one();
+    if(waitForTurn){
+        auto pid = me.pid;
+        me.turn.wait(lock, [this, pid]{ return running == pid; });
+    }
+}
+
+void SimulatedProcesses::block(unique_lock<mutex>& lock, const function<bool()>& condition){
+    auto& me = self();
+    me.canRun = condition;
+    while(!condition() && !me.forced){
+        switchAway(lock, true);
+    }
+    me.canRun = nullptr;
+}
+
+void SimulatedProcesses::run(pid_t pid){
+    unique_lock<mutex> lock(tableMutex);
+    auto& me = *table[pid];
+    me.turn.wait(lock, [this, pid]{ return running == pid; });
+    auto body = me.body;
+    me.body = nullptr;
+
+    int status = 0;
+    auto execd = false;
+    lock.unlock();
+    string failure;
+    try{
+        status = body();
+    } catch(SimulatedExec&){
+        execd = true;
+    } catch(const ShellError& error){
+        failure = error.what();
+        status = 255;
+    }
+    lock.lock();
+
+    if(!failure.empty()){
+        problem(describe(me) + " failed: " + failure);
+    }
+
+    if(execd){
+        // Only stdin, stdout and stderr survive the exec, every other end is close-on-exec
+        me.isShell = false;
+        me.isExec = true;
+        counters.execs++;
+        for(auto it = me.fds.begin(); it != me.fds.end();){
+            if(it->first > 2){
+                release(it->second);
+                it = me.fds.erase(it);
+            } else{
+                ++it;
+            }
+        }
+        auto in = me.fds.find(0);
+        if(in != me.fds.end() && in->second.pipe >= 0){
+            pipes[in->second.pipe].read = true;
+        }
+        auto out = me.fds.find(1);
+        if(out != me.fds.end() && out->second.pipe >= 0 && out->second.isWrite){
+            pipes[out->second.pipe].written = true;
+            pipes[out->second.pipe].writer = me.command;
+        }
+
+        traceProcess(me);
+
+        auto fails = me.command == "false" || (failurePercent > 0 && (int)(random() % 100) < failurePercent);
+        me.status = fails ? 1 : 0;
+        if(me.killedBy != 0){
+            exitProcess(me, me.killedBy);
+        }
+    } else{
+        traceProcess(me);
+        exitProcess(me, me.killedBy != 0 ? me.killedBy : exitedWith(status));
+    }
+
+    switchAway(lock, false);
+}
+
+pid_t SimulatedProcesses::start(const char* role, const function<int()>& child){
+    unique_lock<mutex> lock(tableMutex);
+    auto& parent = self();
+
+    unique_ptr<Process> process(new Process);
+    process->pid = nextPid++;
+    process->parent = parent.pid;
+    process->group = parent.group;
+    process->fds = parent.fds;
+    for(auto& fd : process->fds){
+        retain(fd.second);
+    }
+    process->isShell = true;
+    process->role = role;
+    process->body = child;
+
+    auto pid = process->pid;
+    auto& created = *process;
+    table[pid] = move(process);
+    counters.processes++;
+    created.thread = thread(&SimulatedProcesses::run, this, pid);
+
+    // Sometimes the child gets to run before the parent goes on, as it may after a real fork
+    if(randomize && random() % 2 == 0){
+        handOver(lock, pid, true);
+    }
+    return pid;
+}
+
+void SimulatedProcesses::exec(char* args[]){
+    {
+        lock_guard<mutex> lock(tableMutex);
+        auto& me = self();
+        if(me.pid == ROOT_PID){
+            problem("the shell itself exec'd " + string(args[0]));
+            return;
+        }
+        me.command = args[0];
+        me.commandLine.clear();
+        for(auto arg = args; *arg != NULL; arg++){
+            me.commandLine += (arg == args ? "" : " ") + string(*arg);
+        }
+    }
+    throw SimulatedExec();
+}
+
+// Only pipes are simulated, a caller falls back to one
+int SimulatedProcesses::openMemoryFile(const char*){
+    errno = ENOSYS;
+    return -1;
+}
+
+bool SimulatedProcesses::openPipe(int& readFd, int& writeFd){
+    lock_guard<mutex> lock(tableMutex);
+    auto& me = self();
+    pipes.push_back(Pipe());
+    pipes.back().readers = 1;
+    pipes.back().writers = 1;
+    counters.pipes++;
+
+    readFd = lowestFreeFd(me);
+    me.fds[readFd] = {(int)pipes.size() - 1, false, -1};
+    writeFd = lowestFreeFd(me);
+    me.fds[writeFd] = {(int)pipes.size() - 1, true, -1};
+    return true;
+}
+
+int SimulatedProcesses::close(int fd){
+    lock_guard<mutex> lock(tableMutex);
+    auto& me = self();
+    auto it = me.fds.find(fd);
+    if(it == me.fds.end()){
+        problem(describe(me) + " closed fd " + to_string(fd) + ", which isn't open");
+        return 0;
+    }
+    release(it->second);
+    me.fds.erase(it);
+    return 0;
+}
+
+int SimulatedProcesses::dup2(int fd, int target){
+    lock_guard<mutex> lock(tableMutex);
+    auto& me = self();
+    auto it = me.fds.find(fd);
+    if(it == me.fds.end()){
+        problem(describe(me) + " duplicated fd " + to_string(fd) + ", which isn't open");
+        return target;
+    }
+    if(fd == target){
+        return target;
+    }
+
+    auto end = it->second;
+    auto old = me.fds.find(target);
+    if(old != me.fds.end()){
+        release(old->second);
+    }
+    retain(end);
+    me.fds[target] = end;
+    return target;
+}
+
+void SimulatedProcesses::closeInherited(){
+    lock_guard<mutex> lock(tableMutex);
+    auto& me = self();
+    for(auto it = me.fds.begin(); it != me.fds.end();){
+        if(it->first > 2 && it->second.pipe >= 0){
+            release(it->second);
+            it = me.fds.erase(it);
+        } else{
+            ++it;
+        }
+    }
+}
+
+int SimulatedProcesses::open(const char* path, int){
+    lock_guard<mutex> lock(tableMutex);
+    auto& me = self();
+    auto fd = lowestFreeFd(me);
+    files.push_back(path);
+    me.fds[fd] = {-1, false, (int)files.size() - 1};
+    return fd;
+}
+
+ssize_t SimulatedProcesses::read(int fd, void*, size_t){
+    unique_lock<mutex> lock(tableMutex);
+    auto& me = self();
+    auto it = me.fds.find(fd);
+    if(it == me.fds.end() || it->second.isWrite){
+        problem(describe(me) + " read from fd " + to_string(fd) + ", which isn't open for reading");
+        return 0;
+    }
+
+    auto pipe = it->second.pipe;
+    if(pipe < 0){
+        return 0;
+    }
+    pipes[pipe].read = true;
+    block(lock, [this, pipe]{ return pipes[pipe].writers == 0; });
+    me.forced = false;
+    return 0;
+}
+
+pid_t SimulatedProcesses::wait(pid_t pid, int& status){
+    unique_lock<mutex> lock(tableMutex);
+    auto& me = self();
+    auto parent = me.pid;
+
+    auto child = [this, parent, pid](bool exited) -> Process*{
+        for(auto& entry : table){
+            auto& process = *entry.second;
+            // Like waitpid, -1 is any child and -group any child in that group
+            auto matches = pid == -1 || process.pid == pid || (pid < -1 && process.group == -pid);
+            if(process.parent == parent && !process.reaped && matches &&
+               (!exited || process.exited)){
+                return &process;
+            }
+        }
+        return NULL;
+    };
+
+    if(child(false) == NULL){
+        errno = ECHILD;
+        return -1;
+    }
+
+    block(lock, [&child]{ return child(true) != NULL; });
+    auto done = child(true);
+    if(done == NULL){
+        // The deadlock was broken by failing this wait
+        me.forced = false;
+        errno = EDEADLK;
+        return -1;
+    }
+    me.forced = false;
+    done->reaped = true;
+    status = done->status;
+    return done->pid;
+}
+
+bool SimulatedProcesses::setProcessGroup(pid_t pid, pid_t group){
+    lock_guard<mutex> lock(tableMutex);
+    auto process = pid == 0 ? &self() : find(pid);
+    if(process == NULL){
+        return false;
+    }
+    if(group == 0 || group == process->pid){
+        process->group = process->pid;
+        return true;
+    }
+    for(auto& entry : table){
+        // A zombie still holds its group
+        if(entry.second->group == group && !entry.second->reaped){
+            process->group = group;
+            return true;
+        }
+    }
+    return false;
+}
+
+void SimulatedProcesses::killGroup(pid_t group, int signal){
+    lock_guard<mutex> lock(tableMutex);
+    for(auto& entry : table){
+        auto& process = *entry.second;
+        if(process.group != group || process.exited){
+            continue;
+        }
+        if(process.isExec){
+            exitProcess(process, signal);
+        } else{
+            // Shell code can't be stopped halfway here, it finishes and then reports the signal
+            process.killedBy = signal;
+        }
+    }
+}
+
+pid_t SimulatedProcesses::setForeground(pid_t){
+    // There's no terminal here
+    return -1;
+}
+
+bool SimulatedProcesses::finishLine(){
+    unique_lock<mutex> lock(tableMutex);
+    auto before = problemList.size();
+
+    for(auto& entry : table){
+        auto& process = *entry.second;
+        if(process.isExec && !process.exited){
+            problem(describe(process) + " was still running after the line");
+            exitProcess(process, SIGKILL);
+        }
+    }
+    // Shell code still blocked somewhere gets its calls failed until it is done
+    block(lock, [this]{
+        for(auto& entry : table){
+            if(entry.second->isShell && !entry.second->exited && entry.first != ROOT_PID){
+                return false;
+            }
+        }
+        return true;
+    });
+
+    for(auto& entry : table){
+        auto& process = *entry.second;
+        if(process.parent == ROOT_PID && !process.reaped){
+            problem(describe(process) + " was never waited for");
+        }
+    }
+
+    auto& root = *table[ROOT_PID];
+    for(auto& fd : root.fds){
+        if(fd.first > 2){
+            problem("the shell left fd " + to_string(fd.first) + " open");
+        } else if(fd.second.pipe >= 0){
+            problem("the shell's fd " + to_string(fd.first) + " was left redirected");
+        }
+    }
+    releaseAll(root);
+    root.fds[0] = {-1, false, -1};
+    root.fds[1] = {-1, true, -1};
+    root.fds[2] = {-1, true, -1};
+
+    for(auto& pipe : pipes){
+        if(pipe.written && !pipe.read){
+            problem("the output of " + pipe.writer + " went to a pipe nobody read");
+        }
+    }
+
+    for(auto it = table.begin(); it != table.end();){
+        if(it->first == ROOT_PID){
+            ++it;
+            continue;
+        }
+        if(it->second->thread.joinable()){
+            it->second->thread.join();
+        }
+        it = table.erase(it);
+    }
+    pipes.clear();
+    files.clear();
+
+    return problemList.size() == before;
+}
@@ -0,0 +1,154 @@
+#ifndef SIMPROCESS_H
+#define SIMPROCESS_H
+
+#include "process.h"
+#include <condition_variable>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+// A process backend that spawns nothing. Shell code run by start() gets a thread of its own, but only one
+// simulated process runs at a time and the next one is picked by a seeded generator, so a run is repeatable.
+// An exec'd command moves no data: it exits once every writer of its stdin is gone, with status 1 for
+// "false" (or when failure injection picks it) and 0 otherwise. Reads in the shell return EOF the same way.
+//
+// Wiring mistakes are recorded in problems() instead of failing the operation: operations on fds that
+// aren't open, deadlocks (which are broken by killing the stuck commands), fds or children left behind
+// after a line, and command output that nobody reads. $(...) capture and --meter move real data and
+// aren't covered.
+class SimulatedProcesses : public ProcessBackend {
+public:
+    struct Stats {
+        long long processes = 0;
+        long long execs = 0;
+        long long pipes = 0;
+        long long switches = 0;
+        long long deadlocks = 0;
+    };
+
+    // What a process was set up as, recorded when it exec'd or, for shell code that never did, when it exited
+    struct TraceEntry {
+        pid_t pid;
+        pid_t parent;
+        std::string role;
+        // The command line it exec'd, empty for a shell
+        std::string command;
+        // "inherited", "pipe N" or "file PATH"; pipes are numbered from 1 in every line
+        std::string input;
+        std::string output;
+    };
+
+    // With seed 0 the scheduler always picks the lowest pid that can run; otherwise it picks at random and
+    // sometimes lets a new child run before its parent continues. failurePercent of commands exit with 1.
+    explicit SimulatedProcesses(unsigned seed = 0, int failurePercent = 0);
+    ~SimulatedProcesses();
+
+    pid_t start(const char* role, const std::function<int()>& child) override;
+    void exec(char* args[]) override;
+    bool openPipe(int& readFd, int& writeFd) override;
+    int openMemoryFile(const char* name) override;
+    int close(int fd) override;
+    int dup2(int fd, int target) override;
+    void closeInherited() override;
+    int open(const char* path, int flags) override;
+    ssize_t read(int fd, void* buffer, size_t size) override;
+    pid_t wait(pid_t pid, int& status) override;
+    bool setProcessGroup(pid_t pid, pid_t group = 0) override;
+    void killGroup(pid_t group, int signal) override;
+    pid_t setForeground(pid_t group) override;
+
+    // Call between lines from the thread that runs them: records anything the line left behind and starts
+    // the next one from a clean table. Returns false if the line had any problem.
+    bool finishLine();
+
+    const std::vector<std::string>& problems() const { return problemList; }
+    void clearProblems() { problemList.clear(); }
+    const Stats& stats() const { return counters; }
+
+    void setTracing(bool enabled) { tracing = enabled; }
+    const std::vector<TraceEntry>& trace() const { return traceList; }
+    void clearTrace() { traceList.clear(); }
+
+private:
+    // An open fd: one end of a simulated pipe, or when pipe is -1 a file (index into files) or whatever
+    // the shell itself had
+    struct End {
+        int pipe;
+        bool isWrite;
+        int file;
+    };
+
+    struct Pipe {
+        int readers = 0;
+        int writers = 0;
+        // An exec'd command had it as stdout / something read it (a command's stdin or a shell read)
+        bool written = false;
+        bool read = false;
+        std::string writer;
+    };
+
+    struct Process {
+        pid_t pid = 0;
+        pid_t parent = 0;
+        pid_t group = 0;
+        std::map<int, End> fds;
+        // Runs shell code on its own thread, as opposed to an exec'd command
+        bool isShell = false;
+        bool isExec = false;
+        bool exited = false;
+        bool reaped = false;
+        // Killed while still running shell code, reported when that finishes
+        int killedBy = 0;
+        int status = 0;
+        std::string command;
+        std::string role;
+        std::string commandLine;
+        // A blocked shell process can run again once this holds
+        std::function<bool()> canRun;
+        // Set when a deadlock is broken by failing this process's blocking call
+        bool forced = false;
+        std::function<int()> body;
+        std::thread thread;
+        // Signalled when this process gets the turn
+        std::condition_variable turn;
+    };
+
+    Process& self();
+    Process* find(pid_t pid);
+    int lowestFreeFd(const Process& process) const;
+    void retain(const End& end);
+    void release(const End& end);
+    void releaseAll(Process& process);
+    void exitProcess(Process& process, int status);
+    bool isFinishable(const Process& process) const;
+    bool isReady(const Process& process) const;
+    void run(pid_t pid);
+    void block(std::unique_lock<std::mutex>& lock, const std::function<bool()>& condition);
+    bool switchAway(std::unique_lock<std::mutex>& lock, bool mayStay);
+    void handOver(std::unique_lock<std::mutex>& lock, pid_t next, bool waitForTurn);
+    void breakDeadlock();
+    std::string describe(const Process& process) const;
+    std::string describeFd(const Process& process, int fd) const;
+    void traceProcess(const Process& process);
+    void problem(const std::string& text);
+
+    std::mutex tableMutex;
+    std::map<pid_t, std::unique_ptr<Process>> table;
+    std::vector<Pipe> pipes;
+    std::vector<std::string> files;
+    pid_t running = 1;
+    pid_t nextPid = 2;
+    std::mt19937 random;
+    bool randomize;
+    int failurePercent;
+    Stats counters;
+    std::vector<std::string> problemList;
+    bool tracing = false;
+    std::vector<TraceEntry> traceList;
+};
+
+#endif //SIMPROCESS_H
@@ -0,0 +1,221 @@
+#include "spool.h"
+#include <algorithm>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+using namespace std;
+
+namespace {
+
+// Past this much input the spool goes on in a temporary file, so a long stream doesn't pin its memory
+const long long SPOOL_MEMORY_LIMIT = 64LL * 1024 * 1024;
+// Most a feeder moves into its consumer's pipe at once
+const size_t SPOOL_COPY_SIZE = 256 * 1024;
+
+int createSpoolFile(bool inMemory){
+#ifdef MFD_CLOEXEC
+    if(inMemory){
+        auto fd = memfd_create("eshell-spool", MFD_CLOEXEC);
+        if(fd >= 0){
+            return fd;
+        }
+    }
+#else
+    (void)inMemory;
+#endif
+    auto directory = getenv("TMPDIR");
+    string path = string(directory != NULL && directory[0] != '\0' ? directory : "/tmp") + "/eshell-spool-XXXXXX";
+    // Close-on-exec from the start, feeder threads run while the shell forks
+    auto fd = mkostemp(&path[0], O_CLOEXEC);
+    if(fd >= 0){
+        unlink(path.c_str());
+    }
+    return fd;
+}
+
+// A descriptor of the feeder's own on the spool file, the shared one if /proc isn't there
+int reopen(int fd, bool& owned){
+    char path[64];
+    snprintf(path, sizeof(path), "/proc/self/fd/%d", fd);
+    auto own = open(path, O_RDONLY | O_CLOEXEC);
+    owned = own >= 0;
+    return owned ? own : fd;
+}
+
+// Moves size bytes at offset of in into the pipe out. False if the pipe's reader is gone.
+bool copyToPipe(int in, long long offset, size_t size, int out, bool& canSplice, vector<char>& buffer){
+#ifdef SPLICE_F_MOVE
+    while(canSplice && size > 0){
+        loff_t position = offset;
+        auto moved = splice(in, &position, out, NULL, size, SPLICE_F_MOVE);
+        if(moved < 0 && errno == EINTR){
+            continue;
+        }
+        if(moved < 0 && errno == EINVAL){
+            // Not for this kind of file, copy instead
+            canSplice = false;
+            break;
+        }
+        if(moved <= 0){
+            return false;
+        }
+        offset += moved;
+        size -= moved;
+    }
+#else
+    canSplice = false;
+#endif
+
+    while(size > 0){
+        auto count = pread(in, buffer.data(), min(size, buffer.size()), offset);
+        if(count < 0 && errno == EINTR){
+            continue;
+        }
+        if(count <= 0){
+            return false;
+        }
+        for(ssize_t done = 0; done < count;){
+            auto written = write(out, buffer.data() + done, count - done);
+            if(written < 0 && errno == EINTR){
+                continue;
+            }
+            if(written < 0){
+                return false;
+            }
+            done += written;
+        }
+        offset += count;
+        size -= count;
+    }
+    return true;
+}
+
+}
+
+RepeaterSpool::RepeaterSpool(const vector<int>& consumerFds) : consumers(consumerFds){
+}
+
+RepeaterSpool::~RepeaterSpool(){
+    finish();
+    for(auto& segment : segments){
+        close(segment.fd);
+    }
+}
+
+bool RepeaterSpool::addSegment(bool inMemory){
+    auto fd = createSpoolFile(inMemory);
+    if(fd < 0){
+        return false;
+    }
+    lock_guard<std::mutex> lock(mutex);
+    segments.push_back({fd, size});
+    return true;
+}
+
+bool RepeaterSpool::start(){
+    if(!addSegment(true)){
+        return false;
+    }
+    readingCount = (int)consumers.size();
+    for(size_t i = 0; i < consumers.size(); i++){
+        feeders.push_back(thread(&RepeaterSpool::feed, this, i));
+    }
+    return true;
+}
+
+bool RepeaterSpool::append(const char* data, size_t count){
+    // Only this thread adds segments, the feeders just read the list
+    if(segments.size() == 1 && size >= SPOOL_MEMORY_LIMIT && !addSegment(false)){
+        return false;
+    }
+
+    auto fd = segments.back().fd;
+    for(size_t done = 0; done < count;){
+        auto written = write(fd, data + done, count - done);
+        if(written < 0 && errno == EINTR){
+            continue;
+        }
+        if(written < 0){
+            return false;
+        }
+        done += written;
+    }
+
+    lock_guard<std::mutex> lock(mutex);
+    size += count;
+    grown.notify_all();
+    return true;
+}
+
+void RepeaterSpool::finish(){
+    {
+        lock_guard<std::mutex> lock(mutex);
+        finished = true;
+        grown.notify_all();
+    }
+    for(auto& feeder : feeders){
+        feeder.join();
+    }
+    feeders.clear();
+}
+
+int RepeaterSpool::reading(){
+    lock_guard<std::mutex> lock(mutex);
+    return readingCount;
+}
+
+void RepeaterSpool::feed(size_t consumer){
+    auto out = consumers[consumer];
+    long long offset = 0;
+    size_t current = 0;
+    int in = -1;
+    auto owned = false;
+    auto canSplice = true;
+    vector<char> buffer(SPOOL_COPY_SIZE);
+
+    while(true){
+        Segment segment;
+        long long available;
+        {
+            unique_lock<std::mutex> lock(mutex);
+            grown.wait(lock, [&]{ return size > offset || finished; });
+            if(size == offset){
+                break;
+            }
+            auto previous = current;
+            while(current + 1 < segments.size() && segments[current + 1].start <= offset){
+                current++;
+            }
+            if(current != previous && in >= 0){
+                if(owned){
+                    close(in);
+                }
+                in = -1;
+            }
+            segment = segments[current];
+            auto end = current + 1 < segments.size() ? segments[current + 1].start : size;
+            available = min(end, size) - offset;
+        }
+
+        if(in < 0){
+            in = reopen(segment.fd, owned);
+        }
+        auto chunk = (size_t)min<long long>(available, SPOOL_COPY_SIZE);
+        if(!copyToPipe(in, offset - segment.start, chunk, out, canSplice, buffer)){
+            // The consumer is gone, it gets nothing more
+            break;
+        }
+        offset += chunk;
+    }
+
+    if(in >= 0 && owned){
+        close(in);
+    }
+    close(out);
+    lock_guard<std::mutex> lock(mutex);
+    readingCount--;
+}
@@ -0,0 +1,56 @@
+#ifndef SPOOL_H
+#define SPOOL_H
+
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include <stddef.h>
+
+// --repeater-spool: instead of writing every block to every consumer in turn, the repeater appends its input
+// once to a spool and a feeder thread per consumer copies it from there into that consumer's pipe. A slow
+// consumer only holds back its own feeder, and the producer is never held back by a consumer at all.
+//
+// The spool is a memfd up to SPOOL_MEMORY_LIMIT bytes and an unlinked temporary file after that (a temporary
+// file from the start where there are no memfds). Every feeder reads through a descriptor of its own,
+// reopened through /proc/self/fd, so the kernel tracks each reader's position and readahead separately.
+class RepeaterSpool {
+public:
+    // Takes over the consumer pipes, each feeder closes its own when it's done or the consumer is gone
+    explicit RepeaterSpool(const std::vector<int>& consumerFds);
+    ~RepeaterSpool();
+
+    // Creates the spool and starts the feeders. False if no spool file could be created.
+    bool start();
+
+    // Adds the producer's data for every consumer. False if the spool couldn't take it.
+    bool append(const char* data, size_t size);
+
+    // No more data: the feeders send what's left and close their pipes. Waits for them.
+    void finish();
+
+    // Consumers that haven't closed their end of the pipe yet
+    int reading();
+
+private:
+    // A spool file holding the bytes from start on
+    struct Segment {
+        int fd;
+        long long start;
+    };
+
+    bool addSegment(bool inMemory);
+    void feed(size_t consumer);
+
+    std::vector<int> consumers;
+    std::vector<std::thread> feeders;
+    std::vector<Segment> segments;
+    std::mutex mutex;
+    std::condition_variable grown;
+    long long size = 0;
+    bool finished = false;
+    int readingCount = 0;
+};
+
+#endif //SPOOL_H
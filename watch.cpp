@@ -0,0 +1,339 @@
+#include "watch.h"
+#include "executor.h"
+#include "fdtable.h"
+#include "fileinfo.h"
+#include "process.h"
+#include "wildcard.h"
+#include <iostream>
+#include <chrono>
+#include <map>
+#include <set>
+#include <vector>
+#include <errno.h>
+#include <fnmatch.h>
+#include <poll.h>
+#include <signal.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#ifdef __linux__
+#include <sys/inotify.h>
+#endif
+
+using namespace std;
+
+namespace {
+
+// Quiet time after a change before the line runs again, so an editor saving or a build writing many
+// files starts one run
+const int WATCH_DEBOUNCE_MS = 200;
+// Without inotify: how often the files are checked
+const int WATCH_POLL_MS = 500;
+
+volatile sig_atomic_t stopWatching = 0;
+// What SIGINT and SIGTERM did before the watch, restored after it and in the line's processes
+struct sigaction previousInt, previousTerm;
+
+void onStop(int){
+    stopWatching = 1;
+}
+
+// Tells apart two states of a path for the mtime check, an empty string if it doesn't exist
+string fingerprint(const string& path){
+    struct stat st;
+    if(stat(path.c_str(), &st) != 0){
+        return "";
+    }
+    return to_string((long long)st.st_ino) + ":" + to_string(modificationTime(st)) + ":" + to_string((long long)st.st_size);
+}
+
+string parentOf(const string& path){
+    auto slash = path.rfind('/');
+    if(slash == string::npos){
+        return ".";
+    }
+    return slash == 0 ? "/" : path.substr(0, slash);
+}
+
+string nameOf(const string& path){
+    auto slash = path.rfind('/');
+    return slash == string::npos ? path : path.substr(slash + 1);
+}
+
+// The files and directories a line depends on, and whether one of them changed since they were collected
+class ChangeWatcher {
+public:
+    explicit ChangeWatcher(const string& line){
+#ifdef __linux__
+        inotifyFd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+#endif
+        // The same words the journal records files from
+        for(auto& word : lineWords(line)){
+            addWord(word);
+        }
+    }
+
+    ~ChangeWatcher(){
+        if(inotifyFd >= 0){
+            close(inotifyFd);
+        }
+    }
+
+    // Readable when there are events, -1 if the files are checked by mtime instead
+    int fd() const { return inotifyFd; }
+
+    size_t count() const { return fingerprints.size(); }
+
+    // The first watched path that changed since the last call, empty if none did
+    string changed(){
+        return inotifyFd >= 0 ? readEvents() : compareFingerprints();
+    }
+
+private:
+    struct Directory {
+        string path;
+        // Every entry counts, not just the ones in names or matching patterns
+        bool everything = false;
+        set<string> names;
+        set<string> patterns;
+
+        bool counts(const char* name) const{
+            if(everything || names.count(name)){
+                return true;
+            }
+            for(auto& pattern : patterns){
+                if(fnmatch(pattern.c_str(), name, FNM_PERIOD) == 0){
+                    return true;
+                }
+            }
+            return false;
+        }
+    };
+
+    void addWord(const string& word){
+        if(hasWildcard(word)){
+            watch(parentOf(word), nameOf(word), true);
+            for(auto& match : matchWildcard(word)){
+                watch(parentOf(match), nameOf(match));
+            }
+            return;
+        }
+
+        struct stat st;
+        if(stat(word.c_str(), &st) != 0){
+            return;
+        }
+        if(S_ISDIR(st.st_mode)){
+            watch(word, "");
+        } else if(S_ISREG(st.st_mode)){
+            // The directory is watched rather than the file, an editor saving by rename replaces the file
+            watch(parentOf(word), nameOf(word));
+        }
+    }
+
+    // name is an entry of directory, a wildcard pattern for entries if isPattern, or empty for every entry
+    void watch(const string& directory, const string& name, bool isPattern = false){
+        auto path = name.empty() || isPattern ? directory : directory + "/" + name;
+        fingerprints[path] = fingerprint(path);
+
+#ifdef __linux__
+        if(inotifyFd < 0){
+            return;
+        }
+        auto wd = inotify_add_watch(inotifyFd, directory.c_str(), IN_MODIFY | IN_CLOSE_WRITE | IN_CREATE | IN_DELETE |
+                                    IN_MOVED_FROM | IN_MOVED_TO | IN_DELETE_SELF | IN_MOVE_SELF);
+        if(wd < 0){
+            return;
+        }
+        auto& watched = directories[wd];
+        watched.path = directory;
+        if(isPattern){
+            watched.patterns.insert(name);
+        } else if(name.empty()){
+            watched.everything = true;
+        } else{
+            watched.names.insert(name);
+        }
+#endif
+    }
+
+    string readEvents(){
+        string change;
+#ifdef __linux__
+        char buffer[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+        ssize_t count;
+
+        while((count = read(inotifyFd, buffer, sizeof(buffer))) > 0){
+            for(char* position = buffer; position < buffer + count;){
+                auto event = (const struct inotify_event*)position;
+                position += sizeof(struct inotify_event) + event->len;
+
+                if(event->mask & IN_Q_OVERFLOW){
+                    change = "(too many changes to tell)";
+                    continue;
+                }
+                auto watched = directories.find(event->wd);
+                if(watched == directories.end() || !change.empty()){
+                    continue;
+                }
+                auto& directory = watched->second;
+                if(event->len == 0){
+                    // The directory itself went away or moved
+                    change = directory.path;
+                } else if(directory.counts(event->name)){
+                    change = directory.path + "/" + event->name;
+                }
+            }
+        }
+#endif
+        return change;
+    }
+
+    string compareFingerprints(){
+        for(auto& entry : fingerprints){
+            auto current = fingerprint(entry.first);
+            if(current != entry.second){
+                entry.second = current;
+                return entry.first;
+            }
+        }
+        return "";
+    }
+
+    int inotifyFd = -1;
+    map<int, Directory> directories;
+    map<string, string> fingerprints;
+};
+
+// Runs the line in its own process group, so a cancel reaches everything it started. On a terminal that
+// group gets the terminal, previousForeground is set to the group to give it back to (-1 otherwise).
+// doneWrite stays open in the line's shell processes and closes when they are all gone.
+pid_t startRun(const string& line, int inotifyFd, int doneRead, int doneWrite, pid_t& previousForeground){
+    cout << flush;
+    auto pid = processes->start("watched line", [=]() -> int{
+        processes->setProcessGroup(0);
+        sigaction(SIGINT, &previousInt, NULL);
+        sigaction(SIGTERM, &previousTerm, NULL);
+        processes->close(doneRead);
+        if(inotifyFd >= 0){
+            close(inotifyFd);
+        }
+        vector<char> text(line.begin(), line.end());
+        text.push_back('\0');
+        return runLine(parseInput(text.data()));
+    });
+    assert(pid >= 0, "fork");
+    // Also done here so a cancel can't race the child's own setpgid
+    processes->setProcessGroup(pid);
+    // Only the foreground group may read the terminal, the line would be stopped by SIGTTIN otherwise
+    previousForeground = processes->setForeground(pid);
+    processes->close(doneWrite);
+    return pid;
+}
+
+// Waits for the run and takes the terminal back, 255 if there was nothing to wait for
+int finishRun(pid_t pid, pid_t previousForeground){
+    int status;
+    pid_t reaped;
+    while((reaped = processes->wait(pid, status)) < 0 && errno == EINTR){
+    }
+    if(previousForeground >= 0){
+        processes->setForeground(previousForeground);
+    }
+    if(reaped < 0){
+        return 255;
+    }
+    return WIFEXITED(status) ? WEXITSTATUS(status) : 128 + WTERMSIG(status);
+}
+
+void sleepOrWatch(ChangeWatcher& watcher, int milliseconds){
+    struct pollfd events = {watcher.fd(), POLLIN, 0};
+    poll(&events, watcher.fd() >= 0 ? 1 : 0, milliseconds);
+}
+
+}
+
+void watchLine(const string& line){
+    // Not restarted, so a signal wakes the poll below
+    struct sigaction action;
+    action.sa_handler = onStop;
+    sigemptyset(&action.sa_mask);
+    action.sa_flags = 0;
+    stopWatching = 0;
+    sigaction(SIGINT, &action, &previousInt);
+    sigaction(SIGTERM, &action, &previousTerm);
+
+    while(!stopWatching){
+        // Collected again for every run, a wildcard may match other files by now
+        ChangeWatcher watcher(line);
+        if(watcher.fd() < 0){
+            cerr << "watch: inotify isn't available, checking " << watcher.count() << " paths every "
+                 << WATCH_POLL_MS << " ms" << endl;
+        }
+
+        // Close-on-exec like every pipe of the shell, but not in the fd table: a subshell of the line drops
+        // the table's fds, and doneWrite must stay open in it until it is gone
+        int done[2];
+        assert(processes->openPipe(done[0], done[1]), "pipe error");
+        shellFds.forget(done[0]);
+        shellFds.forget(done[1]);
+        pid_t previousForeground;
+        auto pid = startRun(line, watcher.fd(), done[0], done[1], previousForeground);
+        auto running = true;
+
+        string change;
+        while(!stopWatching && change.empty()){
+            struct pollfd events[2] = {{done[0], POLLIN, 0}, {watcher.fd(), POLLIN, 0}};
+            auto first = running ? 0 : 1;
+            auto count = (watcher.fd() >= 0 ? 2 : 1) - first;
+            if(poll(events + first, count, watcher.fd() >= 0 ? -1 : WATCH_POLL_MS) < 0 && errno != EINTR){
+                break;
+            }
+
+            if(running && events[0].revents != 0){
+                running = false;
+                auto status = finishRun(pid, previousForeground);
+                // With the terminal, ^C went to the line instead of us
+                if(previousForeground >= 0 && status == 128 + SIGINT){
+                    stopWatching = 1;
+                    break;
+                }
+                cerr << "watch: done with status " << status << ", waiting for changes to " << watcher.count()
+                     << " path" << (watcher.count() == 1 ? "" : "s") << endl;
+            }
+            change = watcher.changed();
+        }
+        processes->close(done[0]);
+
+        if(running){
+            // A line stopped by the terminal only gets the SIGTERM once it is continued
+            processes->killGroup(pid, SIGTERM);
+            processes->killGroup(pid, SIGCONT);
+            finishRun(pid, previousForeground);
+            if(!stopWatching){
+                cerr << "watch: cancelled the run in progress" << endl;
+            }
+        }
+        if(stopWatching){
+            break;
+        }
+
+        // Wait for the burst to end: run again only after a quiet spell without further changes
+        cerr << "watch: " << change << " changed" << endl;
+        auto quietUntil = chrono::steady_clock::now() + chrono::milliseconds(WATCH_DEBOUNCE_MS);
+        while(!stopWatching){
+            auto remaining = chrono::duration_cast<chrono::milliseconds>(quietUntil - chrono::steady_clock::now()).count();
+            if(remaining <= 0){
+                break;
+            }
+            sleepOrWatch(watcher, (int)remaining);
+            if(!watcher.changed().empty()){
+                quietUntil = chrono::steady_clock::now() + chrono::milliseconds(WATCH_DEBOUNCE_MS);
+            }
+        }
+    }
+
+    sigaction(SIGINT, &previousInt, NULL);
+    sigaction(SIGTERM, &previousTerm, NULL);
+}
@@ -0,0 +1,19 @@
+#ifndef WATCH_H
+#define WATCH_H
+
+#include <string>
+
+// watch LINE: runs the line, then again whenever one of the files it names changes. A word of the line
+// counts if it names an existing file or directory (a change inside the directory counts), a word with
+// wildcards also watches the directory it's matched in, so a new match counts too. The files are
+// collected again before every run.
+//
+// Changes are watched with inotify where there is one and by checking the files' mtimes otherwise. A burst
+// of changes starts one run, once things have been quiet for a moment. A run still going when a change
+// comes in is killed along with its process group. A line that writes to a file it names starts itself
+// again.
+//
+// Runs until the shell gets SIGINT or SIGTERM, which kill the run in progress and end the watch.
+void watchLine(const std::string& line);
+
+#endif //WATCH_H
@@ -0,0 +1,282 @@
+#include "wildcard.h"
+#include "fileinfo.h"
+#include <dirent.h>
+#include <fnmatch.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <algorithm>
+#include <map>
+#include <string>
+#include <vector>
+#ifdef __linux__
+#include <sys/inotify.h>
+#endif
+
+using namespace std;
+
+namespace {
+
+// Scripts glob in a handful of directories, past this the whole cache is dropped and refilled
+const size_t MAX_CACHED_DIRECTORIES = 256;
+
+struct DirectoryListing {
+    // Identity and version of the directory when it was read
+    dev_t device;
+    ino_t inode;
+    long long modified;
+    long long changed;
+    // inotify watch on the directory, -1 if it isn't watched
+    int watch;
+    // Set by inotify events, the listing must be read again
+    bool stale;
+    // Sorted, without . and ..
+    vector<string> names;
+};
+
+// Keyed by the path as it appears in the pattern ("" for the working directory)
+map<string, DirectoryListing> listings;
+map<int, string> watchedPaths;
+int inotifyFd = -1;
+
+bool isCurrent(const DirectoryListing& listing, const struct stat& st){
+    return listing.device == st.st_dev && listing.inode == st.st_ino &&
+           listing.modified == modificationTime(st) && listing.changed == changeTime(st);
+}
+
+void forgetAll(){
+#ifdef __linux__
+    if(inotifyFd >= 0){
+        for(auto& watched : watchedPaths){
+            inotify_rm_watch(inotifyFd, watched.first);
+        }
+    }
+#endif
+    watchedPaths.clear();
+    listings.clear();
+}
+
+// A forked child shares the inotify instance with the shell, so it must not read the shell's events
+void dropInotifyInChild(){
+    if(inotifyFd < 0){
+        return;
+    }
+    close(inotifyFd);
+    inotifyFd = -1;
+    watchedPaths.clear();
+    for(auto& listing : listings){
+        listing.second.watch = -1;
+    }
+}
+
+// Marks the listings the kernel reported changes for
+void readInotifyEvents(){
+#ifdef __linux__
+    char buffer[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+    ssize_t count;
+
+    while((count = read(inotifyFd, buffer, sizeof(buffer))) > 0){
+        for(char* position = buffer; position < buffer + count;){
+            auto event = (const struct inotify_event*)position;
+            position += sizeof(struct inotify_event) + event->len;
+
+            if(event->mask & IN_Q_OVERFLOW){
+                for(auto& listing : listings){
+                    listing.second.stale = true;
+                }
+                continue;
+            }
+
+            auto watched = watchedPaths.find(event->wd);
+            if(watched == watchedPaths.end()){
+                continue;
+            }
+            auto listing = listings.find(watched->second);
+            if(listing != listings.end()){
+                listing->second.stale = true;
+                if(event->mask & IN_IGNORED){
+                    listing->second.watch = -1;
+                }
+            }
+            if(event->mask & IN_IGNORED){
+                watchedPaths.erase(watched);
+            }
+        }
+    }
+#endif
+}
+
+void watch(const string& dir, DirectoryListing& listing){
+#ifdef __linux__
+    const char* path = dir.empty() ? "." : dir.c_str();
+    listing.watch = inotify_add_watch(inotifyFd, path, IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO |
+                                                       IN_DELETE_SELF | IN_MOVE_SELF | IN_ONLYDIR);
+    if(listing.watch >= 0){
+        watchedPaths[listing.watch] = dir;
+    }
+#else
+    (void)dir;
+    listing.watch = -1;
+#endif
+}
+
+// Returns the sorted entries of dir, or NULL if it can't be listed. The pointer is valid until the next call.
+const vector<string>* listDirectory(const string& dir){
+    const char* path = dir.empty() ? "." : dir.c_str();
+
+    if(inotifyFd >= 0){
+        readInotifyEvents();
+    }
+
+    auto cached = listings.find(dir);
+    if(cached != listings.end() && cached->second.watch >= 0 && !cached->second.stale){
+        return &cached->second.names;
+    }
+
+    // stat before reading, a change while we read shows up as a newer mtime next time
+    struct stat st;
+    if(stat(path, &st) < 0 || !S_ISDIR(st.st_mode)){
+        return NULL;
+    }
+    if(cached != listings.end() && !cached->second.stale && isCurrent(cached->second, st)){
+        return &cached->second.names;
+    }
+
+    if(cached == listings.end() && listings.size() >= MAX_CACHED_DIRECTORIES){
+        forgetAll();
+    }
+
+    auto& listing = listings[dir];
+    listing.device = st.st_dev;
+    listing.inode = st.st_ino;
+    listing.modified = modificationTime(st);
+    listing.changed = changeTime(st);
+    listing.stale = false;
+    listing.names.clear();
+    listing.watch = -1;
+    // The watch goes in before reading, so nothing that happens during the read is missed
+    if(inotifyFd >= 0){
+        watch(dir, listing);
+    }
+
+    auto directory = opendir(path);
+    if(directory == NULL){
+        listings.erase(dir);
+        return NULL;
+    }
+    struct dirent* entry;
+    while((entry = readdir(directory)) != NULL){
+        string name = entry->d_name;
+        if(name != "." && name != ".."){
+            listing.names.push_back(name);
+        }
+    }
+    closedir(directory);
+
+    sort(listing.names.begin(), listing.names.end());
+    return &listing.names;
+}
+
+string joinPath(const string& prefix, const string& name){
+    if(prefix.empty()){
+        return name;
+    }
+    if(prefix[prefix.size() - 1] == '/'){
+        return prefix + name;
+    }
+    return prefix + "/" + name;
+}
+
+// Matches parts[index..] below prefix, one path component at a time
+void expandFrom(const string& prefix, const vector<string>& parts, size_t index, vector<string>& matches){
+    // Literal components are taken as they are, whether the path exists is checked once at the end
+    string path = prefix;
+    size_t next = index;
+    while(next < parts.size() && !hasWildcard(parts[next])){
+        path = joinPath(path, parts[next]);
+        next++;
+    }
+
+    if(next == parts.size()){
+        struct stat st;
+        if(next == index || lstat(path.c_str(), &st) == 0){
+            matches.push_back(path);
+        }
+        return;
+    }
+
+    auto names = listDirectory(path);
+    if(names == NULL){
+        return;
+    }
+
+    // Copied out, the listing may be refreshed or evicted while we descend
+    vector<string> matching;
+    for(auto& name : *names){
+        if(fnmatch(parts[next].c_str(), name.c_str(), FNM_PERIOD) == 0){
+            matching.push_back(name);
+        }
+    }
+    for(auto& name : matching){
+        expandFrom(joinPath(path, name), parts, next + 1, matches);
+    }
+}
+
+}
+
+bool hasWildcard(const string& word){
+    return word.find_first_of("*?[") != string::npos;
+}
+
+vector<string> matchWildcard(const string& pattern){
+    vector<string> parts;
+    size_t start = 0;
+    while(start <= pattern.size()){
+        auto end = pattern.find('/', start);
+        if(end == string::npos){
+            end = pattern.size();
+        }
+        if(end > start){
+            parts.push_back(pattern.substr(start, end - start));
+        }
+        start = end + 1;
+    }
+
+    vector<string> matches;
+    if(pattern.empty()){
+        return matches;
+    }
+    expandFrom(pattern[0] == '/' ? "/" : "", parts, 0, matches);
+
+    // "dir*/" only matches directories and keeps the slash
+    if(pattern[pattern.size() - 1] == '/'){
+        vector<string> directories;
+        for(auto& match : matches){
+            struct stat st;
+            if(stat(match.c_str(), &st) == 0 && S_ISDIR(st.st_mode)){
+                directories.push_back(match + "/");
+            }
+        }
+        matches.swap(directories);
+    }
+
+    sort(matches.begin(), matches.end());
+    return matches;
+}
+
+bool useInotifyForWildcards(){
+#ifdef __linux__
+    if(inotifyFd < 0){
+        inotifyFd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+        if(inotifyFd < 0){
+            return false;
+        }
+        // Listings read so far aren't watched, start over
+        forgetAll();
+        pthread_atfork(NULL, NULL, dropInotifyInChild);
+    }
+    return true;
+#else
+    return false;
+#endif
+}
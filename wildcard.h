@@ -0,0 +1,20 @@
+#ifndef WILDCARD_H
+#define WILDCARD_H
+
+#include <string>
+#include <vector>
+
+// True if the word contains *, ? or [
+bool hasWildcard(const std::string& word);
+
+// Expands *, ? and [...] in a path pattern the way sh would: one path component at a time, matches
+// sorted, names starting with '.' only matched by a pattern that starts with '.'. Returns no matches
+// rather than the pattern itself, the caller decides what to do then.
+std::vector<std::string> matchWildcard(const std::string& pattern);
+
+// Directory listings are cached between lines. By default a cached listing is checked against the
+// directory's mtime before every use; with inotify (Linux only) it is trusted until the kernel reports
+// a change, which saves the stat. Returns false if inotify isn't available.
+bool useInotifyForWildcards();
+
+#endif //WILDCARD_H